@@ -0,0 +1,139 @@
+/*******************************************************************
+    Forwards chat messages and Super chats/stickers to another
+    device as compact binary frames over a serial port.
+
+    Each message is sent as a 2 byte length followed by a MessagePack
+    array (see YouTubeChatFrame.h for the layout). The receiving side
+    can include YouTubeChatFrame.h and use decodeYouTubeChatFrame,
+    it has no Arduino dependencies so also works on a PC/Raspberry Pi.
+
+    Compatible Boards:
+	  - Any ESP32 board
+
+    Parts:
+    ESP32 Mini Kit (ESP32 D1 Mini) * - https://s.click.aliexpress.com/e/_AYPehO (pick the CP2104 Drive version)
+
+ *  * = Affiliate
+
+    If you find what I do useful and would like to support me,
+    please consider becoming a sponsor on Github
+    https://github.com/sponsors/witnessmenow/
+
+
+    Written by Brian Lough
+    YouTube: https://www.youtube.com/brianlough
+    Tindie: https://www.tindie.com/stores/brianlough/
+    Twitter: https://twitter.com/witnessmenow
+ *******************************************************************/
+#define ARDUINOJSON_DECODE_UNICODE 1
+// ----------------------------
+// Standard Libraries
+// ----------------------------
+
+#if defined(ESP8266)
+#include <ESP8266WiFi.h>
+#elif defined(ESP32)
+#include <WiFi.h>
+#endif
+
+#include <WiFiClientSecure.h>
+
+// ----------------------------
+// Additional Libraries - each one of these will need to be installed.
+// ----------------------------
+
+#include <YouTubeLiveStream.h>
+// Library for interacting with YouTube Livestreams
+
+// Only available on Github
+// https://github.com/witnessmenow/youtube-livestream-arduino
+
+#include <ArduinoJson.h>
+// Library used for parsing Json from the API responses
+
+// Search for "Arduino Json" in the Arduino Library manager
+// https://github.com/bblanchon/ArduinoJson
+
+//------- Replace the following! ------
+
+char ssid[] = "SSID";         // your network SSID (name)
+char password[] = "password"; // your network password
+
+#define YT_API_TOKEN "AAAAAAAAAABBBBBBBBBBBCCCCCCCCCCCDDDDDDDDDDD"
+
+#define CHANNEL_ID "UCSJ4gkVC6NrvII8umztf0Ow" //Lo-fi beats (basically always live)
+
+// Pins the other device is connected to
+#define FORWARD_RX_PIN 16
+#define FORWARD_TX_PIN 17
+
+//------- ---------------------- ------
+
+WiFiClientSecure client;
+YouTubeLiveStream ytVideo(client, YT_API_TOKEN);
+
+unsigned long requestDueTime;               //time when request due
+unsigned long delayBetweenRequests = 5000; // Time between requests (5 seconds)
+
+char liveChatId[YOUTUBE_LIVE_CHAT_ID_CHAR_LENGTH];
+char videoId[YOUTUBE_VIDEO_ID_LENGTH];
+bool haveLiveChatId = false;
+
+void setup() {
+  Serial.begin(115200);
+  Serial2.begin(115200, SERIAL_8N1, FORWARD_RX_PIN, FORWARD_TX_PIN);
+
+  // Set WiFi to 'station' mode and disconnect
+  // from the AP if it was previously connected
+  WiFi.mode(WIFI_STA);
+  WiFi.disconnect();
+  delay(100);
+
+  // Connect to the WiFi network
+  Serial.print("\nConnecting to WiFi: ");
+  Serial.println(ssid);
+
+  WiFi.begin(ssid, password);
+  while (WiFi.status() != WL_CONNECTED) {
+    Serial.print(".");
+    delay(500);
+  }
+  Serial.println("\nWiFi connected!");
+  Serial.print("IP address: ");
+  IPAddress ip = WiFi.localIP();
+  Serial.println(ip);
+
+  // NOTE: See "usingHTTPSCerts" example for how to verify the server you are talking to.
+  client.setInsecure();
+}
+
+bool forwardMessage(ChatMessage chatMessage, int index, int numMessages) {
+  // The frame is written straight to the serial port, nothing is copied first
+  if (YouTubeLiveStream::writeChatMessageFrame(Serial2, chatMessage) == 0) {
+    Serial.println("Failed to forward message");
+  }
+
+  return true;
+}
+
+void loop() {
+  if (millis() > requestDueTime) {
+    if (!haveLiveChatId) {
+      haveLiveChatId = ytVideo.getLiveStreamIds(CHANNEL_ID, videoId, sizeof(videoId), liveChatId, sizeof(liveChatId));
+    }
+
+    if (haveLiveChatId) {
+      ChatResponses responses = ytVideo.getChatMessages(forwardMessage, liveChatId);
+      if (!responses.error) {
+        requestDueTime = millis() + responses.pollingIntervalMillis + 500;
+      } else {
+        if (!responses.isStillLive) {
+          haveLiveChatId = false;
+        }
+        requestDueTime = millis() + delayBetweenRequests;
+      }
+    } else {
+      requestDueTime = millis() + delayBetweenRequests;
+    }
+  }
+}
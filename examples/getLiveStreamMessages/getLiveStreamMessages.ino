@@ -2,12 +2,14 @@
     Display messages and Super chats/stickers from a live stream
     on a given channel.
 
-    This technically works on an ESP8266, but it does not have enough
-    memory to handle all the messages, just use an ESP32 for this use
-    case.
+    On an ESP8266 the messages are fetched in small pages (see
+    chatPageSize in setup) as it does not have enough memory to handle
+    all the messages at once. An ESP32 is still the better choice for
+    busy chats.
 
     Compatible Boards:
 	  - Any ESP32 board
+	  - Any ESP8266 board (using small pages)
 
     Parts:
     ESP32 Mini Kit (ESP32 D1 Mini) * - https://s.click.aliexpress.com/e/_AYPehO (pick the CP2104 Drive version)
@@ -91,6 +93,7 @@ YouTubeLiveStream ytVideo(client, YT_API_TOKEN);
 
 unsigned long requestDueTime;               //time when request due
 unsigned long delayBetweenRequests = 5000; // Time between requests (5 seconds)
+unsigned long delayWhileCatchingUp = 1000; // Time between requests while there is a backlog (1 second)
 
 LiveStreamDetails details;
 char liveChatId[YOUTUBE_LIVE_CHAT_ID_CHAR_LENGTH];
@@ -129,6 +132,13 @@ void setup() {
   IPAddress ip = WiFi.localIP();
   Serial.println(ip);
 
+#if defined(ESP8266)
+  // Ask for a few messages at a time so they fit in memory, the library will
+  // adjust this to suit the free heap and grow it while it's catching up.
+  ytVideo.chatPageSize = 20;
+  ytVideo.adaptChatPageSize = true;
+#endif
+
 
   // NOTE: See "usingHTTPSCerts" example for how to verify the server you are talking to.
   client.setInsecure();
@@ -274,7 +284,14 @@ void loop() {
         Serial.print("Polling interval: ");
         Serial.println(responses.pollingIntervalMillis);
 
-        requestDueTime = millis() + responses.pollingIntervalMillis + 500;
+        if (responses.backlog > 0) {
+          // There are more messages waiting, get the next page sooner than the polling interval
+          Serial.print("Messages still waiting: ");
+          Serial.println(responses.backlog);
+          requestDueTime = millis() + delayWhileCatchingUp;
+        } else {
+          requestDueTime = millis() + responses.pollingIntervalMillis + 500;
+        }
       } else if (!responses.isStillLive) {
         //Stream is not live any more.
         haveLiveChatId = false;
@@ -140,6 +140,13 @@ void setup() {
   //TODO: Use certs
   client.setInsecure();
 
+  // Hand us super chats/stickers before any other message, so stopping
+  // early on a command can't skip over them.
+  ytVideo.prioritiseChatMessages = true;
+
+  // Gives us chatMessage.normalizedMessage, so "!ON", "！ｏｎ" and "!on 💡" all match "!on"
+  ytVideo.normalizeChatMessages = true;
+
 }
 
 // We stop processing messages when we find the first one we can react to by returning false.
@@ -149,8 +156,9 @@ void setup() {
 // message to set it !red, there is no point setting it !green first, then !red.
 
 // This cuts down on processing un-needed messages but it has it's downsides.
-// We might miss superchats etc so think carefully about using this approach
-// (If we find a chat command first, we will stop processing messages so could miss a superchat) 
+// Because prioritiseChatMessages is set in setup, super chats/stickers all come
+// first. We keep going after each of them (returning true), so none are skipped,
+// and then stop at the newest command.
 bool processMessage(ChatMessage chatMessage, int index, int numMessages) {
 
   //Serial.print("Total Number of Messages");
@@ -165,7 +173,7 @@ bool processMessage(ChatMessage chatMessage, int index, int numMessages) {
     case yt_message_type_text:
 
       //Possible to act on a message
-      if ( strcmp(chatMessage.displayMessage, "!on") == 0 )
+      if ( strcmp(chatMessage.normalizedMessage, "!on") == 0 )
       {
         Serial.print("Received !on from ");
         Serial.println(chatMessage.displayName);
@@ -173,7 +181,7 @@ bool processMessage(ChatMessage chatMessage, int index, int numMessages) {
         digitalWrite(LED_PIN, ledState);
         isBlinking = false;
         return false;
-      } else if ( strcmp(chatMessage.displayMessage, "!off") == 0 )
+      } else if ( strcmp(chatMessage.normalizedMessage, "!off") == 0 )
       {
         Serial.print("Received !off from ");
         Serial.println(chatMessage.displayName);
@@ -190,8 +198,8 @@ bool processMessage(ChatMessage chatMessage, int index, int numMessages) {
       if(chatMessage.tier >= 0){
         isBlinking = true;
         Serial.print("SuperChat/Sticker from: ");
-        Serial.print(chatMessage.displayName);
-        return false; // This will stop processing messages
+        Serial.println(chatMessage.displayName);
+        return true; // Keep going, there may be more super chats and then commands
       }
       break;
     default:
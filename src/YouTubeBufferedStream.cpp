@@ -0,0 +1,270 @@
+/*
+Copyright (c) 2020 Brian Lough. All right reserved.
+
+YouTubeBufferedStream - Reads from a Client in blocks instead of a byte at a time
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "YouTubeBufferedStream.h"
+
+YouTubeBufferedStream::YouTubeBufferedStream(Client &client, size_t bufferSize)
+{
+    _client = &client;
+    _size = bufferSize;
+    _buffer = (uint8_t *)malloc(bufferSize);
+    if (_buffer == NULL)
+    {
+        _size = 0;
+    }
+}
+
+YouTubeBufferedStream::~YouTubeBufferedStream()
+{
+    free(_buffer);
+}
+
+bool YouTubeBufferedStream::setBufferSize(size_t bufferSize)
+{
+    uint8_t *newBuffer = (uint8_t *)malloc(bufferSize);
+    if (newBuffer == NULL)
+    {
+        return false;
+    }
+
+    // Keep anything that hasn't been read yet
+    size_t buffered = _length - _pos;
+    if (buffered > bufferSize)
+    {
+        buffered = bufferSize;
+    }
+    if (buffered > 0)
+    {
+        memcpy(newBuffer, _buffer + _pos, buffered);
+    }
+
+    free(_buffer);
+    _buffer = newBuffer;
+    _size = bufferSize;
+    _pos = 0;
+    _length = buffered;
+    return true;
+}
+
+void YouTubeBufferedStream::reset()
+{
+    _pos = 0;
+    _length = 0;
+}
+
+// Makes sure there is at least one byte in the buffer, waiting up to the timeout for it
+bool YouTubeBufferedStream::fill()
+{
+    if (_pos < _length)
+    {
+        return true;
+    }
+
+    if (_size == 0)
+    {
+        return false;
+    }
+
+    unsigned long startTime = millis();
+    while (true)
+    {
+        int waiting = _client->available();
+        if (waiting > 0)
+        {
+            size_t toRead = (size_t)waiting < _size ? waiting : _size;
+            int received = _client->read(_buffer, toRead);
+            readCalls++;
+            if (received > 0)
+            {
+                _pos = 0;
+                _length = received;
+                bytesRead += received;
+                return true;
+            }
+        }
+        else if (!_client->connected())
+        {
+            return false;
+        }
+
+        if (millis() - startTime >= _timeout)
+        {
+            return false;
+        }
+
+        // give the esp a breather
+        yield();
+    }
+}
+
+int YouTubeBufferedStream::available()
+{
+    return (_length - _pos) + _client->available();
+}
+
+int YouTubeBufferedStream::read()
+{
+    if (!fill())
+    {
+        return -1;
+    }
+    return _buffer[_pos++];
+}
+
+int YouTubeBufferedStream::peek()
+{
+    if (!fill())
+    {
+        return -1;
+    }
+    return _buffer[_pos];
+}
+
+size_t YouTubeBufferedStream::readBytes(char *buffer, size_t length)
+{
+    size_t count = 0;
+    while (count < length && fill())
+    {
+        size_t chunk = _length - _pos;
+        if (chunk > length - count)
+        {
+            chunk = length - count;
+        }
+        memcpy(buffer + count, _buffer + _pos, chunk);
+        _pos += chunk;
+        count += chunk;
+    }
+    return count;
+}
+
+bool YouTubeBufferedStream::find(const char *target)
+{
+    return find(target, strlen(target));
+}
+
+// Consumes the stream up to and including target. Uses memchr to jump to the
+// next possible start of a match, and KMP so a match split across two blocks
+// (or starting inside a failed partial match) is still found.
+bool YouTubeBufferedStream::find(const char *target, size_t length)
+{
+    if (length == 0)
+    {
+        return true;
+    }
+    if (length > YOUTUBE_FIND_MAX_TARGET)
+    {
+        return false;
+    }
+
+    // fallback[i] is how much of target is still matched after a mismatch at i + 1
+    uint8_t fallback[YOUTUBE_FIND_MAX_TARGET];
+    fallback[0] = 0;
+    for (size_t i = 1, k = 0; i < length; i++)
+    {
+        while (k > 0 && target[i] != target[k])
+        {
+            k = fallback[k - 1];
+        }
+        if (target[i] == target[k])
+        {
+            k++;
+        }
+        fallback[i] = k;
+    }
+
+    size_t matched = 0;
+    while (fill())
+    {
+        if (matched == 0)
+        {
+            const uint8_t *start = (const uint8_t *)memchr(_buffer + _pos, target[0], _length - _pos);
+            if (start == NULL)
+            {
+                _pos = _length;
+                continue;
+            }
+            _pos = start - _buffer;
+        }
+
+        while (_pos < _length)
+        {
+            char c = _buffer[_pos++];
+            while (matched > 0 && c != target[matched])
+            {
+                matched = fallback[matched - 1];
+            }
+            if (c == target[matched])
+            {
+                matched++;
+                if (matched == length)
+                {
+                    return true;
+                }
+            }
+            if (matched == 0)
+            {
+                break; // back to memchr
+            }
+        }
+    }
+
+    return false;
+}
+
+// Same as Stream::readBytesUntil, the terminator is consumed but not stored
+size_t YouTubeBufferedStream::readBytesUntil(char terminator, char *buffer, size_t length)
+{
+    size_t count = 0;
+    while (count < length && fill())
+    {
+        size_t chunk = _length - _pos;
+        if (chunk > length - count)
+        {
+            chunk = length - count;
+        }
+
+        const uint8_t *end = (const uint8_t *)memchr(_buffer + _pos, terminator, chunk);
+        if (end != NULL)
+        {
+            size_t found = end - (_buffer + _pos);
+            memcpy(buffer + count, _buffer + _pos, found);
+            _pos += found + 1;
+            return count + found;
+        }
+
+        memcpy(buffer + count, _buffer + _pos, chunk);
+        _pos += chunk;
+        count += chunk;
+    }
+    return count;
+}
+
+size_t YouTubeBufferedStream::write(uint8_t c)
+{
+    return _client->write(c);
+}
+
+size_t YouTubeBufferedStream::write(const uint8_t *buffer, size_t size)
+{
+    return _client->write(buffer, size);
+}
+
+void YouTubeBufferedStream::flush()
+{
+    _client->flush();
+}
@@ -0,0 +1,80 @@
+/*
+Copyright (c) 2020 Brian Lough. All right reserved.
+
+YouTubeBufferedStream - Reads from a Client in blocks instead of a byte at a time
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef YouTubeBufferedStream_h
+#define YouTubeBufferedStream_h
+
+#include <Arduino.h>
+#include <Client.h>
+
+// Bytes pulled from the client per read, bigger means fewer trips through the TLS layer
+#define YOUTUBE_READ_BUFFER_SIZE 512
+
+// Longest string find() can search for
+#define YOUTUBE_FIND_MAX_TARGET 64
+
+// Reading a byte at a time from something like WiFiClientSecure goes through
+// its locking and timeout logic for every byte. This pulls a block at a time
+// into a buffer and serves all the reads, finds and JSON parsing from that.
+class YouTubeBufferedStream : public Stream
+{
+  public:
+    YouTubeBufferedStream(Client &client, size_t bufferSize = YOUTUBE_READ_BUFFER_SIZE);
+    ~YouTubeBufferedStream();
+
+    // Owns its buffer, so copying would free it twice
+    YouTubeBufferedStream(const YouTubeBufferedStream &) = delete;
+    YouTubeBufferedStream &operator=(const YouTubeBufferedStream &) = delete;
+
+    // Returns false if the new buffer couldn't be allocated (the old one is kept)
+    bool setBufferSize(size_t bufferSize);
+    size_t getBufferSize() { return _size; }
+
+    // Throws away anything buffered, call before each new request
+    void reset();
+
+    int available();
+    int read();
+    int peek();
+    size_t readBytes(char *buffer, size_t length);
+    size_t readBytes(uint8_t *buffer, size_t length) { return readBytes((char *)buffer, length); }
+
+    // Like the Stream versions, but searching the buffer a block at a time
+    bool find(const char *target);
+    bool find(const char *target, size_t length);
+    size_t readBytesUntil(char terminator, char *buffer, size_t length);
+
+    // Writes go straight to the client
+    size_t write(uint8_t c);
+    size_t write(const uint8_t *buffer, size_t size);
+    void flush();
+
+    unsigned long readCalls = 0; // Number of reads from the client
+    unsigned long bytesRead = 0; // Total bytes read from the client
+
+  private:
+    bool fill();
+
+    Client *_client;
+    uint8_t *_buffer;
+    size_t _size;
+    size_t _pos = 0;
+    size_t _length = 0;
+};
+
+#endif
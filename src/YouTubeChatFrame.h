@@ -0,0 +1,293 @@
+/*
+Copyright (c) 2020 Brian Lough. All right reserved.
+
+YouTubeChatFrame - Compact binary frames for forwarding chat messages
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef YouTubeChatFrame_h
+#define YouTubeChatFrame_h
+
+// This file has no Arduino dependencies so the decoder can also be
+// used on the receiving side, e.g. a Linux box reading from UART/UDP.
+//
+// Frame layout:
+//   2 bytes - payload length (big endian, not including these 2 bytes)
+//   payload - a MessagePack array:
+//     [type, flags, displayName, displayMessage]                         (text messages)
+//     [type, flags, displayName, displayMessage, tier, amountMicros, currency] (super chat/sticker)
+//   Strings that are not set are sent as nil.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define YOUTUBE_FRAME_HEADER_SIZE 2
+#define YOUTUBE_FRAME_MAX_PAYLOAD 0xFFFF
+
+#define YOUTUBE_FRAME_TEXT_FIELDS 4
+#define YOUTUBE_FRAME_SUPER_FIELDS 7
+
+// Bits of the flags field
+#define YOUTUBE_FRAME_FLAG_MODERATOR 0x01
+#define YOUTUBE_FRAME_FLAG_OWNER 0x02
+#define YOUTUBE_FRAME_FLAG_SPONSOR 0x04
+#define YOUTUBE_FRAME_FLAG_VERIFIED 0x08
+
+enum YouTubeFrameStatus
+{
+    yt_frame_ok,
+    yt_frame_incomplete, // Need more bytes before the frame can be decoded
+    yt_frame_invalid     // Frame is complete but could not be decoded, skip frameSize bytes
+};
+
+// Strings point into the frame buffer and are NOT null terminated,
+// use the matching length. They are NULL if they were not set.
+struct YouTubeChatFrame
+{
+    uint8_t type; // Matches YoutubeMessageType
+    uint8_t flags;
+    const char *displayName;
+    uint16_t displayNameLength;
+    const char *displayMessage;
+    uint16_t displayMessageLength;
+    bool hasSuperDetails;
+    int32_t tier;
+    int64_t amountMicros;
+    const char *currency;
+    uint16_t currencyLength;
+};
+
+// ----------------------------
+// Encoding helpers, each writes into out (at least 9 bytes) and returns how many bytes were used
+// ----------------------------
+
+inline size_t youTubeFramePackInt(uint8_t *out, int64_t value)
+{
+    if (value >= 0 && value < 128)
+    {
+        out[0] = (uint8_t)value; // positive fixint
+        return 1;
+    }
+    if (value < 0 && value >= -32)
+    {
+        out[0] = (uint8_t)(0xe0 | (value & 0x1f)); // negative fixint
+        return 1;
+    }
+    if (value >= INT32_MIN && value <= INT32_MAX)
+    {
+        uint32_t v = (uint32_t)(int32_t)value;
+        out[0] = 0xd2;
+        out[1] = v >> 24;
+        out[2] = v >> 16;
+        out[3] = v >> 8;
+        out[4] = v;
+        return 5;
+    }
+
+    uint64_t v = (uint64_t)value;
+    out[0] = 0xd3;
+    for (int i = 0; i < 8; i++)
+    {
+        out[1 + i] = v >> (56 - 8 * i);
+    }
+    return 9;
+}
+
+// Only the header, the string bytes are written straight after it by the caller
+inline size_t youTubeFramePackStringHeader(uint8_t *out, size_t length)
+{
+    if (length < 32)
+    {
+        out[0] = 0xa0 | length;
+        return 1;
+    }
+    if (length < 256)
+    {
+        out[0] = 0xd9;
+        out[1] = length;
+        return 2;
+    }
+    out[0] = 0xda;
+    out[1] = length >> 8;
+    out[2] = length;
+    return 3;
+}
+
+inline size_t youTubeFramePackNil(uint8_t *out)
+{
+    out[0] = 0xc0;
+    return 1;
+}
+
+// ----------------------------
+// Decoding, never copies the strings
+// ----------------------------
+
+// Reads one element at *pos. Strings are returned through str/strLength, ints through value.
+// Returns false if the element is malformed or not a string/int/nil.
+inline bool youTubeFrameReadElement(const uint8_t *data, size_t end, size_t *pos, const char **str, uint16_t *strLength, int64_t *value)
+{
+    if (*pos >= end)
+    {
+        return false;
+    }
+
+    uint8_t marker = data[(*pos)++];
+    size_t length = 0;
+    *str = NULL;
+    *strLength = 0;
+    *value = 0;
+
+    if (marker < 0x80)
+    {
+        *value = marker;
+        return true;
+    }
+    if (marker >= 0xe0)
+    {
+        *value = (int8_t)marker;
+        return true;
+    }
+    if (marker == 0xc0)
+    {
+        return true;
+    }
+
+    if ((marker & 0xe0) == 0xa0)
+    {
+        length = marker & 0x1f;
+    }
+    else if (marker == 0xd9)
+    {
+        if (*pos + 1 > end)
+            return false;
+        length = data[(*pos)++];
+    }
+    else if (marker == 0xda)
+    {
+        if (*pos + 2 > end)
+            return false;
+        length = ((size_t)data[*pos] << 8) | data[*pos + 1];
+        *pos += 2;
+    }
+    else if (marker == 0xd2)
+    {
+        if (*pos + 4 > end)
+            return false;
+        uint32_t v = ((uint32_t)data[*pos] << 24) | ((uint32_t)data[*pos + 1] << 16) | ((uint32_t)data[*pos + 2] << 8) | data[*pos + 3];
+        *pos += 4;
+        *value = (int32_t)v;
+        return true;
+    }
+    else if (marker == 0xd3)
+    {
+        if (*pos + 8 > end)
+            return false;
+        uint64_t v = 0;
+        for (int i = 0; i < 8; i++)
+        {
+            v = (v << 8) | data[*pos + i];
+        }
+        *pos += 8;
+        *value = (int64_t)v;
+        return true;
+    }
+    else
+    {
+        return false;
+    }
+
+    if (*pos + length > end)
+    {
+        return false;
+    }
+    *str = (const char *)(data + *pos);
+    *strLength = length;
+    *pos += length;
+    return true;
+}
+
+// Decodes the frame at the start of data. frameSize is set to the total size of the
+// frame (header included) whenever it is known, so the caller can move on to the next one.
+inline YouTubeFrameStatus decodeYouTubeChatFrame(const uint8_t *data, size_t dataLength, YouTubeChatFrame &frame, size_t &frameSize)
+{
+    frameSize = 0;
+    if (dataLength < YOUTUBE_FRAME_HEADER_SIZE)
+    {
+        return yt_frame_incomplete;
+    }
+
+    size_t payloadLength = ((size_t)data[0] << 8) | data[1];
+    frameSize = YOUTUBE_FRAME_HEADER_SIZE + payloadLength;
+    if (dataLength < frameSize)
+    {
+        return yt_frame_incomplete;
+    }
+
+    size_t pos = YOUTUBE_FRAME_HEADER_SIZE;
+    size_t end = frameSize;
+    if (pos >= end || (data[pos] & 0xf0) != 0x90)
+    {
+        return yt_frame_invalid;
+    }
+
+    // Newer senders may add fields on the end, they are skipped by frameSize
+    uint8_t numFields = data[pos++] & 0x0f;
+    if (numFields < YOUTUBE_FRAME_TEXT_FIELDS)
+    {
+        return yt_frame_invalid;
+    }
+
+    const char *str;
+    uint16_t strLength;
+    int64_t value;
+
+    if (!youTubeFrameReadElement(data, end, &pos, &str, &strLength, &value) || str != NULL)
+        return yt_frame_invalid;
+    frame.type = (uint8_t)value;
+
+    if (!youTubeFrameReadElement(data, end, &pos, &str, &strLength, &value) || str != NULL)
+        return yt_frame_invalid;
+    frame.flags = (uint8_t)value;
+
+    if (!youTubeFrameReadElement(data, end, &pos, &frame.displayName, &frame.displayNameLength, &value))
+        return yt_frame_invalid;
+
+    if (!youTubeFrameReadElement(data, end, &pos, &frame.displayMessage, &frame.displayMessageLength, &value))
+        return yt_frame_invalid;
+
+    frame.hasSuperDetails = numFields >= YOUTUBE_FRAME_SUPER_FIELDS;
+    frame.tier = -1;
+    frame.amountMicros = -1;
+    frame.currency = NULL;
+    frame.currencyLength = 0;
+
+    if (frame.hasSuperDetails)
+    {
+        if (!youTubeFrameReadElement(data, end, &pos, &str, &strLength, &value) || str != NULL)
+            return yt_frame_invalid;
+        frame.tier = (int32_t)value;
+
+        if (!youTubeFrameReadElement(data, end, &pos, &str, &strLength, &value) || str != NULL)
+            return yt_frame_invalid;
+        frame.amountMicros = value;
+
+        if (!youTubeFrameReadElement(data, end, &pos, &frame.currency, &frame.currencyLength, &value))
+            return yt_frame_invalid;
+    }
+
+    return yt_frame_ok;
+}
+
+#endif
@@ -0,0 +1,345 @@
+/*
+Copyright (c) 2020 Brian Lough. All right reserved.
+
+YouTubeChatText - Helpers for matching commands and keywords in chat messages
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "YouTubeChatText.h"
+
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+struct CodepointRange
+{
+    uint32_t first;
+    uint32_t last;
+};
+
+// Emoji, symbols and invisible characters that get removed
+static const CodepointRange strippedRanges[] = {
+    {0x00A9, 0x00A9}, // ©
+    {0x00AE, 0x00AE}, // ®
+    {0x200B, 0x200D}, // Zero width space/joiners
+    {0x203C, 0x203C}, // ‼
+    {0x2049, 0x2049}, // ⁉
+    {0x2060, 0x2060}, // Word joiner
+    {0x20E3, 0x20E3}, // Keycap
+    {0x2122, 0x2122}, // ™
+    {0x2190, 0x21FF}, // Arrows
+    {0x2300, 0x23FF}, // Misc technical
+    {0x2460, 0x24FF}, // Enclosed alphanumerics
+    {0x2500, 0x27BF}, // Box drawing, shapes, misc symbols, dingbats
+    {0x2900, 0x297F}, // Supplemental arrows
+    {0x2B00, 0x2BFF}, // Misc symbols and arrows
+    {0x3030, 0x3030}, // 〰
+    {0x303D, 0x303D}, // 〽
+    {0x3297, 0x3299}, // Circled ideographs
+    {0xFE00, 0xFE0F}, // Variation selectors
+    {0xFEFF, 0xFEFF}, // Byte order mark
+    {0x1F000, 0x1FAFF}, // Emoji
+    {0xE0000, 0xE007F}, // Tags (used in flag emoji)
+    {0xE0100, 0xE01EF}, // Variation selectors supplement
+};
+
+static bool isStrippedCodepoint(uint32_t c)
+{
+    if (c < 0x20 || c == 0x7F)
+    {
+        return true;
+    }
+    if (c < 0xA9)
+    {
+        return false;
+    }
+    for (size_t i = 0; i < sizeof(strippedRanges) / sizeof(strippedRanges[0]); i++)
+    {
+        if (c < strippedRanges[i].first)
+        {
+            return false; // ranges are sorted
+        }
+        if (c <= strippedRanges[i].last)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool isWhitespaceCodepoint(uint32_t c)
+{
+    return c == ' ' || (c >= 0x09 && c <= 0x0D) || c == 0x85 || c == 0xA0 || c == 0x1680 ||
+           (c >= 0x2000 && c <= 0x200A) || c == 0x2028 || c == 0x2029 || c == 0x202F ||
+           c == 0x205F || c == 0x3000;
+}
+
+static uint32_t foldCodepoint(uint32_t c)
+{
+    // Full-width ASCII, e.g. "ＯＮ"
+    if (c >= 0xFF01 && c <= 0xFF5E)
+    {
+        c -= 0xFEE0;
+    }
+
+    if (c >= 'A' && c <= 'Z')
+        return c + 0x20;
+    if (c < 0xC0)
+        return c;
+
+    // Latin-1
+    if (c <= 0xDE && c != 0xD7)
+        return c + 0x20;
+
+    // Latin Extended-A, upper and lower case are mostly next to each other
+    if ((c >= 0x0100 && c <= 0x012F) || (c >= 0x0132 && c <= 0x0137) || (c >= 0x014A && c <= 0x0177))
+        return c | 1;
+    if ((c >= 0x0139 && c <= 0x0148) || (c >= 0x0179 && c <= 0x017E))
+        return (c & 1) ? c + 1 : c;
+
+    // Greek
+    if (c >= 0x0391 && c <= 0x03A9 && c != 0x03A2)
+        return c + 0x20;
+
+    // Cyrillic
+    if (c >= 0x0400 && c <= 0x040F)
+        return c + 0x50;
+    if (c >= 0x0410 && c <= 0x042F)
+        return c + 0x20;
+
+    return c;
+}
+
+// Decodes the UTF-8 sequence at text, returns how many bytes it used (0 if it's invalid)
+static size_t decodeUtf8(const uint8_t *text, size_t length, uint32_t *codepoint)
+{
+    uint8_t lead = text[0];
+    size_t needed;
+    uint32_t c;
+
+    if (lead < 0x80)
+    {
+        *codepoint = lead;
+        return 1;
+    }
+    else if ((lead & 0xE0) == 0xC0)
+    {
+        needed = 2;
+        c = lead & 0x1F;
+    }
+    else if ((lead & 0xF0) == 0xE0)
+    {
+        needed = 3;
+        c = lead & 0x0F;
+    }
+    else if ((lead & 0xF8) == 0xF0)
+    {
+        needed = 4;
+        c = lead & 0x07;
+    }
+    else
+    {
+        return 0;
+    }
+
+    if (needed > length)
+    {
+        return 0;
+    }
+
+    for (size_t i = 1; i < needed; i++)
+    {
+        if ((text[i] & 0xC0) != 0x80)
+        {
+            return 0;
+        }
+        c = (c << 6) | (text[i] & 0x3F);
+    }
+
+    *codepoint = c;
+    return needed;
+}
+
+static size_t encodeUtf8(uint32_t c, char *out)
+{
+    if (c < 0x80)
+    {
+        out[0] = c;
+        return 1;
+    }
+    if (c < 0x800)
+    {
+        out[0] = 0xC0 | (c >> 6);
+        out[1] = 0x80 | (c & 0x3F);
+        return 2;
+    }
+    if (c < 0x10000)
+    {
+        out[0] = 0xE0 | (c >> 12);
+        out[1] = 0x80 | ((c >> 6) & 0x3F);
+        out[2] = 0x80 | (c & 0x3F);
+        return 3;
+    }
+    out[0] = 0xF0 | (c >> 18);
+    out[1] = 0x80 | ((c >> 12) & 0x3F);
+    out[2] = 0x80 | ((c >> 6) & 0x3F);
+    out[3] = 0x80 | (c & 0x3F);
+    return 4;
+}
+
+// Fast path for plain ASCII words (no spaces/control characters). Lower cases
+// and copies as many whole blocks as it can, returns how many bytes it handled.
+static size_t copyAsciiBlocks(const uint8_t *text, size_t length, char *out, size_t room)
+{
+    size_t done = 0;
+
+#if defined(__SSE2__)
+    const __m128i space = _mm_set1_epi8(0x20);
+    const __m128i del = _mm_set1_epi8(0x7F);
+    const __m128i beforeA = _mm_set1_epi8('A' - 1);
+    const __m128i afterZ = _mm_set1_epi8('Z' + 1);
+    const __m128i caseBit = _mm_set1_epi8(0x20);
+
+    while (length - done >= 16 && room - done >= 16)
+    {
+        __m128i block = _mm_loadu_si128((const __m128i *)(text + done));
+
+        // Bytes >= 0x80 are negative, so fail the > space check too
+        __m128i printable = _mm_andnot_si128(_mm_cmpeq_epi8(block, del), _mm_cmpgt_epi8(block, space));
+        if (_mm_movemask_epi8(printable) != 0xFFFF)
+        {
+            break;
+        }
+
+        __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(block, beforeA), _mm_cmplt_epi8(block, afterZ));
+        block = _mm_or_si128(block, _mm_and_si128(upper, caseBit));
+        _mm_storeu_si128((__m128i *)(out + done), block);
+        done += 16;
+    }
+#endif
+
+    while (length - done >= 4 && room - done >= 4)
+    {
+        uint32_t word;
+        memcpy(&word, text + done, 4); // Not always aligned
+
+        // Any byte >= 0x80, <= 0x20 or == 0x7F falls back to the slow path
+        uint32_t high = word & 0x80808080;
+        uint32_t low = (word - 0x21212121) & ~word & 0x80808080;
+        uint32_t delBytes = word ^ 0x7F7F7F7F; // DEL bytes become zero
+        uint32_t isDel = (delBytes - 0x01010101) & ~delBytes & 0x80808080;
+        if (high | low | isDel)
+        {
+            break;
+        }
+
+        // Sets the 0x20 bit on bytes between 'A' and 'Z'
+        uint32_t aboveA = word + 0x3F3F3F3F; // 0x80 - 'A'
+        uint32_t aboveZ = word + 0x25252525; // 0x80 - ('Z' + 1)
+        uint32_t upper = aboveA & ~aboveZ & 0x80808080;
+        word |= upper >> 2;
+
+        memcpy(out + done, &word, 4);
+        done += 4;
+    }
+
+    return done;
+}
+
+size_t normalizeChatText(const char *text, char *out, size_t outSize)
+{
+    if (outSize == 0)
+    {
+        return 0;
+    }
+
+    size_t written = 0;
+    size_t room = outSize - 1; // leave room for null
+    out[0] = '\0';
+    if (text == NULL)
+    {
+        return 0;
+    }
+
+    const uint8_t *in = (const uint8_t *)text;
+    size_t length = strlen(text);
+    size_t pos = 0;
+    bool pendingSpace = false;
+
+    while (pos < length)
+    {
+        if (in[pos] > 0x20 && in[pos] < 0x7F)
+        {
+            if (pendingSpace)
+            {
+                // Only worth adding the space if something can follow it
+                if (written + 1 >= room)
+                {
+                    break;
+                }
+                out[written++] = ' ';
+                pendingSpace = false;
+            }
+
+            size_t copied = copyAsciiBlocks(in + pos, length - pos, out + written, room - written);
+            pos += copied;
+            written += copied;
+            if (copied > 0)
+            {
+                continue;
+            }
+        }
+
+        uint32_t codepoint;
+        size_t used = decodeUtf8(in + pos, length - pos, &codepoint);
+        if (used == 0)
+        {
+            // Not valid UTF-8, drop the byte
+            pos++;
+            continue;
+        }
+        pos += used;
+
+        if (isWhitespaceCodepoint(codepoint))
+        {
+            pendingSpace = written > 0;
+            continue;
+        }
+
+        if (isStrippedCodepoint(codepoint))
+        {
+            continue;
+        }
+
+        char encoded[4];
+        size_t encodedLength = encodeUtf8(foldCodepoint(codepoint), encoded);
+        if (written + (pendingSpace ? 1 : 0) + encodedLength > room)
+        {
+            break;
+        }
+
+        if (pendingSpace)
+        {
+            out[written++] = ' ';
+            pendingSpace = false;
+        }
+        memcpy(out + written, encoded, encodedLength);
+        written += encodedLength;
+    }
+
+    out[written] = '\0';
+    return written;
+}
@@ -0,0 +1,36 @@
+/*
+Copyright (c) 2020 Brian Lough. All right reserved.
+
+YouTubeChatText - Helpers for matching commands and keywords in chat messages
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef YouTubeChatText_h
+#define YouTubeChatText_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Writes a normalized copy of text into out, so "  ＨＥＬＬＯ 👋  World!" becomes "hello world!".
+//  - Upper case is folded to lower case (ASCII, full-width, Latin-1, Latin Extended-A, Greek and Cyrillic)
+//  - Full-width ASCII (e.g. "！ｏｎ") is turned into normal ASCII
+//  - Emoji, symbols, zero-width and control characters are removed
+//  - Runs of whitespace become a single space, with none at the start or end
+//
+// ASCII punctuation is kept, so commands like "!on" still match.
+// out is always null terminated (if outSize > 0), and is cut short on a
+// character boundary if it's too small. Returns the length written to out.
+size_t normalizeChatText(const char *text, char *out, size_t outSize);
+
+#endif
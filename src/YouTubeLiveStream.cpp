@@ -19,6 +19,7 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
 #include "YouTubeLiveStream.h"
 
 YouTubeLiveStream::YouTubeLiveStream(Client &client, const char *apiToken)
+    : stream(client)
 {
     this->client = &client;
     this->_apiToken = apiToken;
@@ -27,6 +28,7 @@ YouTubeLiveStream::YouTubeLiveStream(Client &client, const char *apiToken)
 }
 
 YouTubeLiveStream::YouTubeLiveStream(Client &client, const char **apiTokenArray, int tokenArrayLength)
+    : stream(client)
 {
     this->client = &client;
     this->_apiTokenArray = apiTokenArray;
@@ -39,6 +41,8 @@ int YouTubeLiveStream::makeGetRequest(const char *command, const char *host, con
 {
     client->flush();
     client->setTimeout(YOUTUBE_TIMEOUT);
+    stream.setTimeout(YOUTUBE_TIMEOUT);
+    stream.reset();
     if (!client->connect(host, portNumber))
     {
         #ifdef YOUTUBE_SERIAL_OUTPUT
@@ -85,11 +89,19 @@ int YouTubeLiveStream::makeGetRequest(const char *command, const char *host, con
         return false;
     }
 
+    // Roughly when the server sees the request, used for chat freshness
+    requestStartMillis = millis();
+
     int statusCode = getHttpStatusCode();
+    responseMillis = millis();
     return statusCode;
 }
 
 bool YouTubeLiveStream::getLiveVideoId(const char *channelId, char *videoIdOut, int videoIdOutSize){
+    return searchForLiveVideo(channelId, videoIdOut, videoIdOutSize) == yt_live_check_live;
+}
+
+YoutubeLiveCheckResult YouTubeLiveStream::searchForLiveVideo(const char *channelId, char *videoIdOut, int videoIdOutSize){
     char command[250];
 
     if(_tokenArrayLength > 0){
@@ -116,17 +128,25 @@ bool YouTubeLiveStream::getLiveVideoId(const char *channelId, char *videoIdOut,
 
         // Parse JSON object
         #ifndef YOUTUBE_PRINT_JSON_PARSE
-        DeserializationError error = deserializeJson(doc, *client, DeserializationOption::Filter(filter));
+        DeserializationError error = deserializeJson(doc, stream, DeserializationOption::Filter(filter));
         #else
-        ReadLoggingStream loggingStream(*client, Serial);
+        ReadLoggingStream loggingStream(stream, Serial);
         DeserializationError error = deserializeJson(doc, loggingStream, DeserializationOption::Filter(filter));
         #endif
         if (!error)
         {
-            strncpy(videoIdOut, doc["items"][0]["id"]["videoId"].as<const char *>(), videoIdOutSize);
-            videoIdOut[videoIdOutSize -1] = '\0';
+            const char *videoId = doc["items"][0]["id"]["videoId"];
             closeClient();
-            return true;
+            if (videoId == NULL)
+            {
+                // No live videos on this channel
+                videoIdOut[0] = '\0';
+                return yt_live_check_not_live;
+            }
+
+            strncpy(videoIdOut, videoId, videoIdOutSize);
+            videoIdOut[videoIdOutSize -1] = '\0';
+            return yt_live_check_live;
 
         }
         else
@@ -138,7 +158,7 @@ bool YouTubeLiveStream::getLiveVideoId(const char *channelId, char *videoIdOut,
         }
     }
     closeClient();
-    return false;
+    return yt_live_check_error;
 }
 
 LiveStreamDetails YouTubeLiveStream::getLiveStreamDetails(const char *videoId){
@@ -172,9 +192,9 @@ LiveStreamDetails YouTubeLiveStream::getLiveStreamDetails(const char *videoId){
 
         // Parse JSON object
         #ifndef YOUTUBE_PRINT_JSON_PARSE
-        DeserializationError error = deserializeJson(doc, *client, DeserializationOption::Filter(filter));
+        DeserializationError error = deserializeJson(doc, stream, DeserializationOption::Filter(filter));
         #else
-        ReadLoggingStream loggingStream(*client, Serial);
+        ReadLoggingStream loggingStream(stream, Serial);
         DeserializationError error = deserializeJson(doc, loggingStream, DeserializationOption::Filter(filter));
         #endif
         if (!error)
@@ -216,10 +236,10 @@ LiveStreamDetails YouTubeLiveStream::getLiveStreamDetails(const char *videoId){
         #endif
 
         #ifdef YOUTUBE_DEBUG
-        while (client->available() )
+        while (stream.available() )
         {
             char c = 0;
-            client->readBytes(&c, 1);
+            stream.readBytes(&c, 1);
             Serial.print(c);
 
         }
@@ -231,10 +251,14 @@ LiveStreamDetails YouTubeLiveStream::getLiveStreamDetails(const char *videoId){
 }
 
 bool YouTubeLiveStream::scrapeIsChannelLive(const char *channelId, char *videoIdOut, int videoIdOutSize){
+    return scrapeForLiveVideo(channelId, videoIdOut, videoIdOutSize) == yt_live_check_live;
+}
+
+YoutubeLiveCheckResult YouTubeLiveStream::scrapeForLiveVideo(const char *channelId, char *videoIdOut, int videoIdOutSize){
     char command[100];
     sprintf(command, youTubeChannelUrl, channelId);
 
-    bool channelIsLive = true;
+    YoutubeLiveCheckResult channelIsLive = yt_live_check_live;
 
     #ifdef YOUTUBE_DEBUG
     Serial.print("url: ");
@@ -243,23 +267,32 @@ bool YouTubeLiveStream::scrapeIsChannelLive(const char *channelId, char *videoId
 
     int statusCode = makeGetRequest(command, YOUTUBE_HOST, "*/*", YOUTUBE_ACCEPT_COOKIES_COOKIE);
     if(statusCode == 200) {
-        if (!client->find("{\"text\":\" watching\"}"))
+        if (!stream.find(YOUTUBE_SCRAPE_PAGE_MARKER))
+        {
+            // The live badge comes after this, so if it's missing the page has
+            // changed (or it's a consent page etc.) and we can't say it's not live
+            #ifdef YOUTUBE_SERIAL_OUTPUT
+            Serial.println(F("Channel page not in the expected format"));
+            #endif
+
+            channelIsLive = yt_live_check_error;
+        } else if (!stream.find("{\"text\":\" watching\"}"))
         {
             #ifdef YOUTUBE_DEBUG
             Serial.println(F("Channel doesn't seem to be live"));
             #endif
 
-            channelIsLive = false;
+            channelIsLive = yt_live_check_not_live;
         } else if (videoIdOut != NULL){
-            if (!client->find("{\"videoId\":\""))
+            if (!stream.find("{\"videoId\":\""))
             {
                 videoIdOut[0] = '\0';
                 #ifdef YOUTUBE_SERIAL_OUTPUT
                 Serial.println(F("Could not find videoID"));
                 #endif
-                channelIsLive = false;
+                channelIsLive = yt_live_check_error;
             } else {
-                client->readBytesUntil('\"', videoIdOut, videoIdOutSize - 1); // leave room for null
+                stream.readBytesUntil('\"', videoIdOut, videoIdOutSize - 1); // leave room for null
                 videoIdOut[videoIdOutSize - 1] = '\0';
             }
         }
@@ -270,15 +303,15 @@ bool YouTubeLiveStream::scrapeIsChannelLive(const char *channelId, char *videoId
         #endif
 
         #ifdef YOUTUBE_DEBUG
-        while (client->available() )
+        while (stream.available() )
         {
             char c = 0;
-            client->readBytes(&c, 1);
+            stream.readBytes(&c, 1);
             Serial.print(c);
 
         }
         #endif
-        channelIsLive = false;
+        channelIsLive = yt_live_check_error;
     }
 
     closeClient();
@@ -286,8 +319,121 @@ bool YouTubeLiveStream::scrapeIsChannelLive(const char *channelId, char *videoId
 
 }
 
+bool YouTubeLiveStream::getLiveStreamIds(const char *channelId, char *videoIdOut, int videoIdOutSize, char *liveChatIdOut, int liveChatIdOutSize){
+    YoutubeLiveDetectMethod method = chooseLiveDetectMethod();
+    YoutubeLiveCheckResult result = detectLiveStream(method, channelId, videoIdOut, videoIdOutSize, liveChatIdOut, liveChatIdOutSize);
+
+    if (result == yt_live_check_error)
+    {
+        // The cheap option let us down, try the other one
+        method = (method == yt_detect_scrape) ? yt_detect_search : yt_detect_scrape;
+
+        #ifdef YOUTUBE_DEBUG
+        Serial.print(F("Live detection failed, falling back to method: "));
+        Serial.println(method);
+        #endif
+
+        result = detectLiveStream(method, channelId, videoIdOut, videoIdOutSize, liveChatIdOut, liveChatIdOutSize);
+    }
+
+    lastDetectMethod = method;
+    return result == yt_live_check_live;
+}
+
+YoutubeLiveDetectMethod YouTubeLiveStream::chooseLiveDetectMethod(){
+    float scrapeScore = liveDetectScore(scrapeStats, YOUTUBE_VIDEOS_QUOTA_COST);
+    float searchScore = liveDetectScore(searchStats, YOUTUBE_SEARCH_QUOTA_COST + YOUTUBE_VIDEOS_QUOTA_COST);
+
+    #ifdef YOUTUBE_DEBUG
+    Serial.print(F("Live detection cost, scrape: "));
+    Serial.print(scrapeScore);
+    Serial.print(F(" search: "));
+    Serial.println(searchScore);
+    #endif
+
+    return (scrapeScore <= searchScore) ? yt_detect_scrape : yt_detect_search;
+}
+
+// Expected cost of getting a trustworthy answer from a method, in units of quota.
+// Time and bytes are converted using quotaUnitCostMillis and quotaUnitCostBytes, and the
+// cost is divided by the success rate (starting from one success in two tries so each
+// method gets a go)
+float YouTubeLiveStream::liveDetectScore(const LiveDetectMethodStats &stats, unsigned long expectedQuota){
+    float avgQuota = expectedQuota;
+    float avgMillis = 0;
+    float avgBytes = 0;
+    if (stats.attempts > 0)
+    {
+        avgQuota = (float)stats.quotaUsed / stats.attempts;
+        avgMillis = (float)stats.totalMillis / stats.attempts;
+        avgBytes = (float)stats.totalBytes / stats.attempts;
+    }
+
+    float cost = avgQuota;
+    if (quotaUnitCostMillis > 0)
+    {
+        cost += avgMillis / quotaUnitCostMillis;
+    }
+    if (quotaUnitCostBytes > 0)
+    {
+        cost += avgBytes / quotaUnitCostBytes;
+    }
+    return cost * (stats.attempts + 2) / (stats.successes + 1);
+}
+
+YoutubeLiveCheckResult YouTubeLiveStream::detectLiveStream(YoutubeLiveDetectMethod method, const char *channelId, char *videoIdOut, int videoIdOutSize, char *liveChatIdOut, int liveChatIdOutSize){
+    LiveDetectMethodStats *stats = (method == yt_detect_scrape) ? &scrapeStats : &searchStats;
+    unsigned long startTime = millis();
+    unsigned long startBytes = stream.bytesRead;
+
+    liveChatIdOut[0] = '\0';
+
+    YoutubeLiveCheckResult result;
+    if (method == yt_detect_scrape)
+    {
+        result = scrapeForLiveVideo(channelId, videoIdOut, videoIdOutSize);
+    }
+    else
+    {
+        result = searchForLiveVideo(channelId, videoIdOut, videoIdOutSize);
+        stats->quotaUsed += YOUTUBE_SEARCH_QUOTA_COST;
+    }
+
+    if (result == yt_live_check_live)
+    {
+        // Confirm the video is actually live (a scraped ID could be stale or a
+        // premiere), this also gets us the liveChatId for 1 unit of quota.
+        LiveStreamDetails details = getLiveStreamDetails(videoIdOut);
+        stats->quotaUsed += YOUTUBE_VIDEOS_QUOTA_COST;
+
+        if (details.error || !details.isLive)
+        {
+            #ifdef YOUTUBE_SERIAL_OUTPUT
+            Serial.print(F("Could not verify live video: "));
+            Serial.println(videoIdOut);
+            #endif
+            result = yt_live_check_error;
+        }
+        else
+        {
+            strncpy(liveChatIdOut, details.activeLiveChatId, liveChatIdOutSize);
+            liveChatIdOut[liveChatIdOutSize - 1] = '\0';
+        }
+    }
+
+    stats->attempts++;
+    if (result != yt_live_check_error)
+    {
+        stats->successes++;
+    }
+    stats->totalMillis += millis() - startTime;
+    stats->totalBytes += stream.bytesRead - startBytes;
+
+    return result;
+}
+
 ChatResponses YouTubeLiveStream::getChatMessages(processChatMessage chatMessageCallback, const char *liveChatId, bool reverse, const char *part){
-    char command[300];
+    char command[350];
 
     if(_tokenArrayLength > 0){
         rotateApiKey();
@@ -296,25 +442,32 @@ ChatResponses YouTubeLiveStream::getChatMessages(processChatMessage chatMessageC
     sprintf(command, liveChatMessagesEndpoint, liveChatId, part, _apiToken);
 
     if(nextPageToken[0] != 0){
-        char nextPageParam[50];
+        char nextPageParam[70];
         sprintf(nextPageParam, "&pageToken=%s", nextPageToken);
         strcat(command, nextPageParam);
     }
 
+    if(chatPageSize > 0){
+        char maxResultsParam[20];
+        sprintf(maxResultsParam, "&maxResults=%d", chatPageSize);
+        strcat(command, maxResultsParam);
+    }
+
     #ifdef YOUTUBE_DEBUG
     Serial.println(command);
     #endif
 
     chatResponses.error = true;
     chatResponses.isStillLive = true; //assume, we'll update if not
+    chatResponses.numMessages = 0;
+    chatResponses.backlog = 0;
+    chatResponses.pageSize = chatPageSize;
 
-    // Get from https://arduinojson.org/v6/assistant/
-    const size_t bufferSize = 30000;
     int statusCode = makeGetRequest(command);
     if (statusCode == 200)
     {
         skipHeaders();
-        StaticJsonDocument<272> filter;
+        StaticJsonDocument<304> filter;
         filter["pollingIntervalMillis"] = true;
         filter["offlineAt"] = true;
         filter["nextPageToken"] = true;
@@ -328,28 +481,41 @@ ChatResponses YouTubeLiveStream::getChatMessages(processChatMessage chatMessageC
         JsonObject filter_items_0_authorDetails = filter_items_0.createNestedObject("authorDetails");
         filter_items_0_authorDetails["displayName"] = true;
         filter_items_0_authorDetails["isChatModerator"] = true;
+        filter_items_0_authorDetails["isChatOwner"] = true;
         filter_items_0_authorDetails["isChatSponsor"] = true;
         filter_items_0_authorDetails["isVerified"] = true;
 
         JsonObject filter_items_0_snippet = filter_items_0.createNestedObject("snippet");
         filter_items_0_snippet["displayMessage"] = true;
         filter_items_0_snippet["type"] = true;
+        filter_items_0_snippet["publishedAt"] = true;
         filter_items_0_snippet["superChatDetails"] = true;
         filter_items_0_snippet["superStickerDetails"] = true;
 
+        size_t bufferSize = chatDocumentSize();
+        if (adaptChatPageSize && chatPageSize > 0)
+        {
+            // Checked now the connection is up, so the TLS buffers are already taken
+            bufferSize = fitChatDocumentToHeap(bufferSize);
+        }
+
         // Allocate DynamicJsonDocument
         DynamicJsonDocument doc(bufferSize);
 
         // Parse JSON object
         #ifndef YOUTUBE_PRINT_JSON_PARSE
-        DeserializationError error = deserializeJson(doc, *client, DeserializationOption::Filter(filter));
+        DeserializationError error = deserializeJson(doc, stream, DeserializationOption::Filter(filter));
         #else
-        ReadLoggingStream loggingStream(*client, Serial);
+        ReadLoggingStream loggingStream(stream, Serial);
         DeserializationError error = deserializeJson(doc, loggingStream, DeserializationOption::Filter(filter));
         #endif
         if (!error)
         {
             chatResponses.error = false;
+            if (chatResponses.pageSize > largestParsedChatPageSize)
+            {
+                largestParsedChatPageSize = chatResponses.pageSize;
+            }
             chatResponses.isStillLive = !doc.containsKey("offlineAt");
             const char* pageToken = doc["nextPageToken"];
             strcpy(nextPageToken, pageToken);
@@ -357,99 +523,60 @@ ChatResponses YouTubeLiveStream::getChatMessages(processChatMessage chatMessageC
             chatResponses.totalResults = doc["pageInfo"]["totalResults"].as<int>();
             chatResponses.resultsPerPage = doc["pageInfo"]["resultsPerPage"].as<int>();
             JsonArray items = doc["items"];
-            //Serial.print("Got Here");
-            int numMessages = YOUTUBE_MAX_RESULTS > items.size() ? items.size() : YOUTUBE_MAX_RESULTS;
-            int index = 0;
-            for(int i = 0; i < numMessages ; i++){
 
-                //Reverse index
-                if(reverse){
-                    index = items.size() - 1 - i;
-                } else {
-                    index = i;
-                }
-
-#ifdef YOUTUBE_DEBUG
-                Serial.print(F("Message: "));
-                serializeJson(items[index], Serial);
-#endif
-
-                // init message back to blank
-                chatMessage.displayMessage = nullptr;
-                chatMessage.displayName = nullptr;
-                chatMessage.type = yt_message_type_unknown;
-                chatMessage.tier = -1;
-                chatMessage.amountMicros = -1;
-                chatMessage.currency = nullptr;
-
-                // It's possible for users to not request snippet
-                if (items[index].containsKey("snippet")) {
-
-                    const char *messageType = items[index]["snippet"]["type"]; 
-                    #ifdef YOUTUBE_DEBUG
-                    Serial.print("messageType: ");
-                    Serial.println(messageType);
-                    #endif
+            // Only a full page means the server might have more waiting, totalResults
+            // alone can't be trusted for that
+            if (chatResponses.pageSize > 0 && (int)items.size() == chatResponses.pageSize &&
+                chatResponses.totalResults > (int)items.size())
+            {
+                chatResponses.backlog = chatResponses.totalResults - items.size();
+            }
 
-                    if (strncmp(messageType, "textMessageEvent", 16) == 0)
+            // One dip in the heap shouldn't cap the page size for good, so raise the
+            // limit again when a full page at the limit parses with room to spare
+            if (adaptChatPageSize && chatPageSizeLimit > 0 && chatResponses.backlog > 0 &&
+                chatResponses.pageSize >= chatPageSizeLimit)
+            {
+                long freeBlock = largestFreeHeapBlock();
+                if (freeBlock >= YOUTUBE_HEAP_RESERVE + YOUTUBE_CHAT_PAGE_SIZE_STEP * YOUTUBE_CHAT_DOC_BYTES_PER_MESSAGE)
+                {
+                    chatPageSizeLimit += YOUTUBE_CHAT_PAGE_SIZE_STEP;
+                    if (chatPageSizeLimit >= YOUTUBE_CHAT_MAX_PAGE_SIZE)
                     {
-                        chatMessage.type = yt_message_type_text;
-                        chatMessage.displayMessage = items[index]["snippet"]["displayMessage"].as<const char *>();
-
+                        chatPageSizeLimit = 0;
                     }
-                    else if (strncmp(messageType, "superChatEvent", 14) == 0)
-                    {
-                        chatMessage.type = yt_message_type_superChat;
-
-                        JsonObject superChatDetails = items[index]["snippet"]["superChatDetails"];
-
-                        if(superChatDetails.containsKey("userComment")){
-                            chatMessage.displayMessage = superChatDetails["userComment"].as<const char *>();
-                        }
-                        
-                        chatMessage.tier = superChatDetails["tier"].as<int>();
-                        chatMessage.amountMicros = superChatDetails["amountMicros"].as<long>();
-
-                        chatMessage.currency = superChatDetails["currency"].as<const char *>();
-                    } 
-                    else if (strncmp(messageType, "superStickerEvent", 17) == 0)
-                    {
-                        chatMessage.type = yt_message_type_superSticker;
+                }
+            }
 
-                        JsonObject superStickerDetails = items[index]["snippet"]["superStickerDetails"];
+            if (adaptChatPageSize && chatPageSize > 0 && chatResponses.backlog > 0)
+            {
+                chatPageSize += YOUTUBE_CHAT_PAGE_SIZE_STEP;
+                if (chatPageSize > YOUTUBE_CHAT_MAX_PAGE_SIZE)
+                {
+                    chatPageSize = YOUTUBE_CHAT_MAX_PAGE_SIZE;
+                }
+                if (chatPageSizeLimit > 0 && chatPageSize > chatPageSizeLimit)
+                {
+                    chatPageSize = chatPageSizeLimit;
+                }
+            }
+            //Serial.print("Got Here");
 
-                        if(superStickerDetails.containsKey("userComment")){
-                            chatMessage.displayMessage = superStickerDetails["userComment"].as<const char *>();
-                        }                      
+            // Only references are sorted, the messages stay where they are in the doc
+            ChatDispatchEntry dispatchOrder[YOUTUBE_MAX_RESULTS];
+            int numMessages = orderChatMessages(items, reverse, dispatchOrder);
+            chatResponses.numMessages = numMessages;
 
-                        chatMessage.tier = superStickerDetails["tier"].as<int>();
-                        chatMessage.amountMicros = superStickerDetails["amountMicros"].as<long>();
+            for(int i = 0; i < numMessages ; i++){
+                JsonObject item = dispatchOrder[i].item;
 
-                        chatMessage.currency = superStickerDetails["currency"].as<const char *>();
-                    }
-                    else
-                    {
-                        chatMessage.type = yt_message_type_unknown;
-                    }
-                    
-                }
+#ifdef YOUTUBE_DEBUG
+                Serial.print(F("Message: "));
+                serializeJson(item, Serial);
+#endif
 
-                 // It's possible for users to not request authorDetails, it's only needed if you need the name of person who sent the message.
-                if (items[index].containsKey("authorDetails")) {
-                    chatMessage.displayName = items[index]["authorDetails"]["displayName"].as<const char *>();
-                    chatMessage.isChatModerator = items[index]["authorDetails"]["isChatModerator"].as<bool>();
-                    chatMessage.isChatOwner = items[index]["authorDetails"]["isChatOwner"].as<bool>();
-                    chatMessage.isChatSponsor = items[index]["authorDetails"]["isChatSponsor"].as<bool>();
-                    chatMessage.isVerified = items[index]["authorDetails"]["isVerified"].as<bool>();
-                } else {
-                    #ifdef YOUTUBE_SERIAL_OUTPUT
-                    Serial.println("no authorDetails");
-                    #endif
-                    chatMessage.isChatModerator = false;
-                    chatMessage.isChatOwner = false;
-                    chatMessage.isChatSponsor = false;
-                    chatMessage.isVerified = false;
-                }
+                parseChatMessage(item);
+                recordChatFreshness();
 
                 if(!chatMessageCallback(chatMessage, i, numMessages)){
                     //User has indicated they are finished.
@@ -464,11 +591,39 @@ ChatResponses YouTubeLiveStream::getChatMessages(processChatMessage chatMessageC
             Serial.print(F("deserializeJson() failed with code "));
             Serial.println(error.c_str());
             #endif
+
+            // nextPageToken wasn't updated, so the next call asks for the same messages in a smaller page
+            if (adaptChatPageSize && chatPageSize > 0 && error == DeserializationError::NoMemory)
+            {
+                // Work from the size that was requested and failed, chatPageSize may
+                // already have been shrunk to fit the heap
+                int failedPageSize = chatResponses.pageSize;
+
+                // Don't grow back to a size that has failed, or we'd just fail again
+                int limit = failedPageSize - YOUTUBE_CHAT_PAGE_SIZE_STEP;
+                if (largestParsedChatPageSize > 0 && largestParsedChatPageSize < limit)
+                {
+                    limit = largestParsedChatPageSize;
+                }
+                if (chatPageSizeLimit == 0 || limit < chatPageSizeLimit)
+                {
+                    chatPageSizeLimit = limit < YOUTUBE_CHAT_MIN_PAGE_SIZE ? YOUTUBE_CHAT_MIN_PAGE_SIZE : limit;
+                }
+
+                if (failedPageSize / 2 < chatPageSize)
+                {
+                    chatPageSize = failedPageSize / 2;
+                }
+                if (chatPageSize < YOUTUBE_CHAT_MIN_PAGE_SIZE)
+                {
+                    chatPageSize = YOUTUBE_CHAT_MIN_PAGE_SIZE;
+                }
+            }
         }
     } else if(statusCode == 403) {
-        if (client->find("\"reason\": \"")){
+        if (stream.find("\"reason\": \"")){
             char errorMessage[100] = {0};
-            client->readBytesUntil('"', errorMessage, sizeof(errorMessage));
+            stream.readBytesUntil('"', errorMessage, sizeof(errorMessage));
             if(strcmp(errorMessage, "liveChatEnded") == 0)
             {
                 #ifdef YOUTUBE_SERIAL_OUTPUT
@@ -487,25 +642,503 @@ ChatResponses YouTubeLiveStream::getChatMessages(processChatMessage chatMessageC
 
 
 
-void YouTubeLiveStream::skipHeaders(bool tossUnexpectedForJSON)
+size_t YouTubeLiveStream::chatDocumentSize()
 {
-    // Skip HTTP headers
-    if (!client->find("\r\n\r\n"))
+    if (chatPageSize <= 0)
     {
+        return YOUTUBE_CHAT_DOC_SIZE;
+    }
+    return YOUTUBE_CHAT_DOC_BASE_SIZE + (size_t)chatPageSize * YOUTUBE_CHAT_DOC_BYTES_PER_MESSAGE;
+}
+
+// Shrinks the document to fit in the largest free block of heap, and chatPageSize to
+// match so the next call asks for a page that will fit. Returns the document size to use.
+size_t YouTubeLiveStream::fitChatDocumentToHeap(size_t documentSize)
+{
+    long freeBlock = largestFreeHeapBlock();
+    if (freeBlock < 0)
+    {
+        return documentSize;
+    }
+
+    long available = freeBlock - YOUTUBE_HEAP_RESERVE;
+    if (available < 0)
+    {
+        available = 0;
+    }
+    if ((long)documentSize > available)
+    {
+        documentSize = available;
+    }
+
+    long fits = available > YOUTUBE_CHAT_DOC_BASE_SIZE ? (available - YOUTUBE_CHAT_DOC_BASE_SIZE) / YOUTUBE_CHAT_DOC_BYTES_PER_MESSAGE : 0;
+    if (chatPageSize > fits)
+    {
+        chatPageSize = fits < YOUTUBE_CHAT_MIN_PAGE_SIZE ? YOUTUBE_CHAT_MIN_PAGE_SIZE : fits;
+    }
+
+    #ifdef YOUTUBE_DEBUG
+    Serial.print(F("Largest free heap block: "));
+    Serial.print(freeBlock);
+    Serial.print(F(" chat document size: "));
+    Serial.print((unsigned long)documentSize);
+    Serial.print(F(" next chat page size: "));
+    Serial.println(chatPageSize);
+    #endif
+
+    return documentSize;
+}
+
+// -1 if we don't know how to check on this board
+long YouTubeLiveStream::largestFreeHeapBlock()
+{
+#if defined(ESP8266)
+    return ESP.getMaxFreeBlockSize();
+#elif defined(ESP32)
+    return ESP.getMaxAllocHeap();
+#else
+    return -1;
+#endif
+}
+
+// Fills chatMessage from one item of the liveChat/messages response
+void YouTubeLiveStream::parseChatMessage(JsonObject item)
+{
+    // init message back to blank
+    chatMessage.displayMessage = nullptr;
+    chatMessage.normalizedMessage = nullptr;
+    chatMessage.displayName = nullptr;
+    chatMessage.type = yt_message_type_unknown;
+    chatMessage.tier = -1;
+    chatMessage.amountMicros = -1;
+    chatMessage.currency = nullptr;
+    chatMessage.publishedAtMillis = -1;
+
+    // It's possible for users to not request snippet
+    if (item.containsKey("snippet")) {
+
+        chatMessage.publishedAtMillis = parseRfc3339Millis(item["snippet"]["publishedAt"].as<const char *>());
+
+        const char *messageType = item["snippet"]["type"]; 
+        #ifdef YOUTUBE_DEBUG
+        Serial.print("messageType: ");
+        Serial.println(messageType);
+        #endif
+
+        if (strncmp(messageType, "textMessageEvent", 16) == 0)
+        {
+            chatMessage.type = yt_message_type_text;
+            chatMessage.displayMessage = item["snippet"]["displayMessage"].as<const char *>();
+
+        }
+        else if (strncmp(messageType, "superChatEvent", 14) == 0)
+        {
+            chatMessage.type = yt_message_type_superChat;
+
+            JsonObject superChatDetails = item["snippet"]["superChatDetails"];
+
+            if(superChatDetails.containsKey("userComment")){
+                chatMessage.displayMessage = superChatDetails["userComment"].as<const char *>();
+            }
+            
+            chatMessage.tier = superChatDetails["tier"].as<int>();
+            chatMessage.amountMicros = superChatDetails["amountMicros"].as<long>();
+
+            chatMessage.currency = superChatDetails["currency"].as<const char *>();
+        } 
+        else if (strncmp(messageType, "superStickerEvent", 17) == 0)
+        {
+            chatMessage.type = yt_message_type_superSticker;
+
+            JsonObject superStickerDetails = item["snippet"]["superStickerDetails"];
+
+            if(superStickerDetails.containsKey("userComment")){
+                chatMessage.displayMessage = superStickerDetails["userComment"].as<const char *>();
+            }                      
+
+            chatMessage.tier = superStickerDetails["tier"].as<int>();
+            chatMessage.amountMicros = superStickerDetails["amountMicros"].as<long>();
+
+            chatMessage.currency = superStickerDetails["currency"].as<const char *>();
+        }
+        else
+        {
+            chatMessage.type = yt_message_type_unknown;
+        }
+        
+    }
+
+    // It's possible for users to not request authorDetails, it's only needed if you need the name of person who sent the message.
+    if (item.containsKey("authorDetails")) {
+        chatMessage.displayName = item["authorDetails"]["displayName"].as<const char *>();
+        chatMessage.isChatModerator = item["authorDetails"]["isChatModerator"].as<bool>();
+        chatMessage.isChatOwner = item["authorDetails"]["isChatOwner"].as<bool>();
+        chatMessage.isChatSponsor = item["authorDetails"]["isChatSponsor"].as<bool>();
+        chatMessage.isVerified = item["authorDetails"]["isVerified"].as<bool>();
+    } else {
         #ifdef YOUTUBE_SERIAL_OUTPUT
-        Serial.println(F("Invalid response"));
+        Serial.println("no authorDetails");
         #endif
+        chatMessage.isChatModerator = false;
+        chatMessage.isChatOwner = false;
+        chatMessage.isChatSponsor = false;
+        chatMessage.isVerified = false;
+    }
+
+    if (normalizeChatMessages && chatMessage.displayMessage != nullptr)
+    {
+        normalizeChatText(chatMessage.displayMessage, normalizedMessageBuffer, sizeof(normalizedMessageBuffer));
+        chatMessage.normalizedMessage = normalizedMessageBuffer;
+    }
+}
+
+// Index of the highest priority dispatch class the message falls into
+int YouTubeLiveStream::chatMessagePriority(JsonObject item)
+{
+    const char *messageType = item["snippet"]["type"];
+    if (messageType != NULL && (strncmp(messageType, "superChatEvent", 14) == 0 || strncmp(messageType, "superStickerEvent", 17) == 0))
+    {
+        return yt_priority_super;
+    }
+
+    JsonObject authorDetails = item["authorDetails"];
+    if (authorDetails["isChatOwner"].as<bool>() || authorDetails["isChatModerator"].as<bool>())
+    {
+        return yt_priority_owner_or_moderator;
+    }
+
+    return yt_priority_regular;
+}
+
+// Works out which items to dispatch and in what order, writing them into
+// dispatchOrder (YOUTUBE_MAX_RESULTS long). Returns the number of messages.
+// Indexing a JsonArray walks it from the start, so the items are only
+// visited once here, with the iterator, and classified as we go.
+int YouTubeLiveStream::orderChatMessages(JsonArray items, bool reverse, ChatDispatchEntry *dispatchOrder)
+{
+    int numItems = items.size();
+    int numMessages = YOUTUBE_MAX_RESULTS > numItems ? numItems : YOUTUBE_MAX_RESULTS;
+
+    if (!prioritiseChatMessages)
+    {
+        // Just the first (or last) numMessages items
+        int first = reverse ? numItems - numMessages : 0;
+        int index = 0;
+        for (JsonObject item : items)
+        {
+            if (index >= first + numMessages)
+            {
+                break;
+            }
+            if (index >= first)
+            {
+                //Reverse index
+                ChatDispatchEntry &entry = dispatchOrder[reverse ? numItems - 1 - index : index - first];
+                entry.item = item;
+                entry.index = index;
+                entry.priority = yt_priority_regular;
+            }
+            index++;
+        }
+        return numMessages;
+    }
+
+    // Keep the numMessages items that would be dispatched first. Once that's full, a new
+    // item only goes in if it beats the last of the lowest class kept, so high priority
+    // messages are never the ones dropped when there are more than YOUTUBE_MAX_RESULTS items
+    int classCount[yt_priority_count] = {0};
+    int kept = 0;
+    int index = 0;
+    for (JsonObject item : items)
+    {
+        ChatDispatchEntry entry;
+        entry.item = item;
+        entry.index = index++;
+        entry.priority = chatMessagePriority(item);
+
+        int slot = -1;
+        if (kept < numMessages)
+        {
+            slot = kept++;
+        }
+        else
+        {
+            int worst = yt_priority_count - 1;
+            while (worst > 0 && classCount[worst] == 0)
+            {
+                worst--;
+            }
+            // Items come oldest first, so going forwards a later one of the same class
+            // can only win if the super chats are being sorted by amount
+            if (entry.priority < worst || (entry.priority == worst && (reverse || (sortPriorityByAmount && worst == yt_priority_super))))
+            {
+                int last = -1;
+                for (int i = 0; i < kept; i++)
+                {
+                    if (dispatchOrder[i].priority == worst && (last < 0 || dispatchesBefore(dispatchOrder[last], dispatchOrder[i], reverse)))
+                    {
+                        last = i;
+                    }
+                }
+                if (dispatchesBefore(entry, dispatchOrder[last], reverse))
+                {
+                    slot = last;
+                    classCount[worst]--;
+                }
+            }
+        }
+
+        if (slot >= 0)
+        {
+            dispatchOrder[slot] = entry;
+            classCount[entry.priority]++;
+        }
+    }
+
+    // Insertion sort, there are at most YOUTUBE_MAX_RESULTS and they're mostly in order already
+    for (int i = 1; i < kept; i++)
+    {
+        ChatDispatchEntry entry = dispatchOrder[i];
+        int j = i - 1;
+        while (j >= 0 && dispatchesBefore(entry, dispatchOrder[j], reverse))
+        {
+            dispatchOrder[j + 1] = dispatchOrder[j];
+            j--;
+        }
+        dispatchOrder[j + 1] = entry;
+    }
+
+    return numMessages;
+}
+
+// Class first, then (for super chats/stickers with sortPriorityByAmount) tier and amount,
+// then the forward/reverse order they came in
+bool YouTubeLiveStream::dispatchesBefore(const ChatDispatchEntry &a, const ChatDispatchEntry &b, bool reverse)
+{
+    if (a.priority != b.priority)
+    {
+        return a.priority < b.priority;
+    }
+
+    if (sortPriorityByAmount && a.priority == yt_priority_super)
+    {
+        int compare = compareSuperDetails(a.item, b.item);
+        if (compare != 0)
+        {
+            return compare > 0;
+        }
+    }
+
+    return reverse ? a.index > b.index : a.index < b.index;
+}
+
+static JsonObject superDetailsOf(JsonObject item)
+{
+    JsonObject snippet = item["snippet"];
+    if (snippet.containsKey("superChatDetails"))
+    {
+        return snippet["superChatDetails"];
+    }
+    return snippet["superStickerDetails"];
+}
+
+// Negative if a is worth less than b
+int YouTubeLiveStream::compareSuperDetails(JsonObject a, JsonObject b)
+{
+    JsonObject detailsA = superDetailsOf(a);
+    JsonObject detailsB = superDetailsOf(b);
+
+    int tierA = detailsA["tier"].as<int>();
+    int tierB = detailsB["tier"].as<int>();
+    if (tierA != tierB)
+    {
+        return tierA < tierB ? -1 : 1;
+    }
+
+    long amountA = detailsA["amountMicros"].as<long>();
+    long amountB = detailsB["amountMicros"].as<long>();
+    if (amountA != amountB)
+    {
+        return amountA < amountB ? -1 : 1;
+    }
+    return 0;
+}
+
+// Lets the Print based encoder write into a plain buffer
+class YouTubeFrameBufferPrint : public Print
+{
+  public:
+    YouTubeFrameBufferPrint(uint8_t *buffer, size_t size) : _buffer(buffer), _size(size), _length(0) {}
+
+    size_t write(uint8_t c)
+    {
+        return write(&c, 1);
+    }
+
+    size_t write(const uint8_t *data, size_t size)
+    {
+        if (_length + size > _size)
+        {
+            return 0;
+        }
+        memcpy(_buffer + _length, data, size);
+        _length += size;
+        return size;
+    }
+
+  private:
+    uint8_t *_buffer;
+    size_t _size;
+    size_t _length;
+};
+
+size_t YouTubeLiveStream::chatMessageFrameSize(const ChatMessage &chatMessage)
+{
+    return YOUTUBE_FRAME_HEADER_SIZE + encodeChatMessageFrame(NULL, chatMessage);
+}
+
+size_t YouTubeLiveStream::writeChatMessageFrame(Print &out, const ChatMessage &chatMessage)
+{
+    size_t payloadLength = encodeChatMessageFrame(NULL, chatMessage);
+    if (payloadLength > YOUTUBE_FRAME_MAX_PAYLOAD)
+    {
+        return 0;
+    }
+
+    uint8_t header[YOUTUBE_FRAME_HEADER_SIZE] = {(uint8_t)(payloadLength >> 8), (uint8_t)payloadLength};
+    if (out.write(header, sizeof(header)) != sizeof(header))
+    {
+        return 0;
+    }
+
+    if (encodeChatMessageFrame(&out, chatMessage) != payloadLength)
+    {
+        return 0;
+    }
+
+    return YOUTUBE_FRAME_HEADER_SIZE + payloadLength;
+}
+
+size_t YouTubeLiveStream::writeChatMessageFrame(uint8_t *buffer, size_t bufferSize, const ChatMessage &chatMessage)
+{
+    YouTubeFrameBufferPrint bufferPrint(buffer, bufferSize);
+    return writeChatMessageFrame(bufferPrint, chatMessage);
+}
+
+// Adds the size of the packed bytes to length, and writes them if out is set
+static void writeFramePart(Print *out, const uint8_t *data, size_t size, size_t *length)
+{
+    if (out != NULL)
+    {
+        *length += out->write(data, size);
+    }
+    else
+    {
+        *length += size;
+    }
+}
+
+static void writeFrameInt(Print *out, int64_t value, size_t *length)
+{
+    uint8_t packed[9];
+    writeFramePart(out, packed, youTubeFramePackInt(packed, value), length);
+}
+
+static void writeFrameString(Print *out, const char *value, size_t *length)
+{
+    uint8_t packed[3];
+    if (value == NULL)
+    {
+        writeFramePart(out, packed, youTubeFramePackNil(packed), length);
         return;
     }
 
+    size_t stringLength = strlen(value);
+    if (stringLength > YOUTUBE_FRAME_MAX_PAYLOAD)
+    {
+        stringLength = YOUTUBE_FRAME_MAX_PAYLOAD;
+    }
+    writeFramePart(out, packed, youTubeFramePackStringHeader(packed, stringLength), length);
+    writeFramePart(out, (const uint8_t *)value, stringLength, length);
+}
+
+// Writes the frame payload to out, or just works out its size if out is NULL.
+// Returns the payload size (short if out failed to take everything).
+size_t YouTubeLiveStream::encodeChatMessageFrame(Print *out, const ChatMessage &chatMessage)
+{
+    bool hasSuperDetails = chatMessage.type == yt_message_type_superChat || chatMessage.type == yt_message_type_superSticker;
+
+    uint8_t flags = 0;
+    if (chatMessage.isChatModerator)
+        flags |= YOUTUBE_FRAME_FLAG_MODERATOR;
+    if (chatMessage.isChatOwner)
+        flags |= YOUTUBE_FRAME_FLAG_OWNER;
+    if (chatMessage.isChatSponsor)
+        flags |= YOUTUBE_FRAME_FLAG_SPONSOR;
+    if (chatMessage.isVerified)
+        flags |= YOUTUBE_FRAME_FLAG_VERIFIED;
+
+    size_t length = 0;
+    uint8_t arrayHeader = 0x90 | (hasSuperDetails ? YOUTUBE_FRAME_SUPER_FIELDS : YOUTUBE_FRAME_TEXT_FIELDS);
+    writeFramePart(out, &arrayHeader, 1, &length);
+
+    writeFrameInt(out, chatMessage.type, &length);
+    writeFrameInt(out, flags, &length);
+    writeFrameString(out, chatMessage.displayName, &length);
+    writeFrameString(out, chatMessage.displayMessage, &length);
+
+    if (hasSuperDetails)
+    {
+        writeFrameInt(out, chatMessage.tier, &length);
+        writeFrameInt(out, chatMessage.amountMicros, &length);
+        writeFrameString(out, chatMessage.currency, &length);
+    }
+
+    return length;
+}
+
+void YouTubeLiveStream::skipHeaders(bool tossUnexpectedForJSON)
+{
+    // Skip HTTP headers, a line at a time so we can pick out the Date
+    char line[64];
+    while (true)
+    {
+        size_t length = stream.readBytesUntil('\n', line, sizeof(line) - 1);
+        if (length == 0 && stream.peek() < 0)
+        {
+            #ifdef YOUTUBE_SERIAL_OUTPUT
+            Serial.println(F("Invalid response"));
+            #endif
+            return;
+        }
+        line[length] = '\0';
+
+        if (length == sizeof(line) - 1)
+        {
+            // Longer than we care about, skip the rest of it
+            stream.find("\n");
+        }
+
+        // Blank line is the end of the headers
+        if (length == 0 || (length == 1 && line[0] == '\r'))
+        {
+            break;
+        }
+
+        if (strncasecmp(line, "Date:", 5) == 0)
+        {
+            updateServerClock(line + 5);
+        }
+    }
+
     if (tossUnexpectedForJSON)
     {
         // Was getting stray characters between the headers and the body
         // This should toss them away
-        while (client->available() && client->peek() != '{')
+        while (stream.available() && stream.peek() != '{')
         {
             char c = 0;
-            client->readBytes(&c, 1);
+            stream.readBytes(&c, 1);
             #ifdef YOUTUBE_DEBUG
             Serial.print(F("Tossing an unexpected character: "));
             Serial.println(c);
@@ -514,10 +1147,74 @@ void YouTubeLiveStream::skipHeaders(bool tossUnexpectedForJSON)
     }
 }
 
+// Works out the difference between the server's clock and millis() from an HTTP Date header.
+// The Date header is only to the second and is always a little behind by the time we read it,
+// so each sample is a lower bound. Keeping the biggest one gets closer to the real offset.
+void YouTubeLiveStream::updateServerClock(const char *dateValue)
+{
+    int64_t serverMillis = parseHttpDateMillis(dateValue);
+    if (serverMillis < 0)
+    {
+        return;
+    }
+
+    int64_t sample = serverMillis - (int64_t)responseMillis;
+    if (!haveServerClockOffset || sample > serverClockOffsetMillis || serverClockOffsetMillis - sample > YOUTUBE_CLOCK_RESET_MILLIS)
+    {
+        // (A sample way below the estimate means millis() wrapped or the clock moved, so start again)
+        serverClockOffsetMillis = sample;
+        haveServerClockOffset = true;
+    }
+
+    #ifdef YOUTUBE_DEBUG
+    Serial.print(F("Server clock offset: "));
+    Serial.println((long)(serverClockOffsetMillis / 1000));
+    #endif
+}
+
+int64_t YouTubeLiveStream::serverTimeMillis()
+{
+    if (!haveServerClockOffset)
+    {
+        return -1;
+    }
+    return (int64_t)millis() + serverClockOffsetMillis;
+}
+
+void YouTubeLiveStream::resetChatFreshness()
+{
+    memset(&chatFreshness, 0, sizeof(chatFreshness));
+}
+
+// Adds the current chatMessage to the freshness histograms and sets its latencyMillis
+void YouTubeLiveStream::recordChatFreshness()
+{
+    chatMessage.latencyMillis = -1;
+
+    unsigned long now = millis();
+    addLatencySample(chatFreshness.responseToCallback, (int64_t)(now - responseMillis));
+
+    if (!haveServerClockOffset || chatMessage.publishedAtMillis < 0)
+    {
+        return;
+    }
+
+    // When the message was published, in millis() time
+    int64_t published = chatMessage.publishedAtMillis - serverClockOffsetMillis;
+
+    addLatencySample(chatFreshness.pollWait, (int64_t)requestStartMillis - published);
+    addLatencySample(chatFreshness.publishToResponse, (int64_t)responseMillis - published);
+
+    int64_t latency = (int64_t)now - published;
+    addLatencySample(chatFreshness.publishToCallback, latency);
+    chatMessage.latencyMillis = latency < 0 ? 0 : latency;
+}
+
 int YouTubeLiveStream::getHttpStatusCode()
 {
     char status[32] = {0};
-    client->readBytesUntil('\r', status, sizeof(status));
+    stream.readBytesUntil('\r', status, sizeof(status) - 1);
+    stream.find("\n"); // rest of the status line, so the headers start on a fresh line
     #ifdef YOUTUBE_DEBUG
     Serial.print(F("Status: "));
     Serial.println(status);
@@ -570,6 +1267,7 @@ void YouTubeLiveStream::closeClient()
         #endif
         client->stop();
     }
+    stream.reset();
 }
 
 void YouTubeLiveStream::initStructs()
@@ -577,6 +1275,10 @@ void YouTubeLiveStream::initStructs()
     liveStreamDetails.concurrentViewers = (char *)malloc(YOUTUBE_VIEWERS_CHAR_LENGTH);
     liveStreamDetails.activeLiveChatId = (char *)malloc(YOUTUBE_LIVE_CHAT_ID_CHAR_LENGTH);
 
+    memset(&scrapeStats, 0, sizeof(scrapeStats));
+    memset(&searchStats, 0, sizeof(searchStats));
+    resetChatFreshness();
+
 }
 
 // Not sure why this would ever be needed, but sure why not.
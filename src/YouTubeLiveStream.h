@@ -36,6 +36,11 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
 #include <ArduinoJson.h>
 #include <Client.h>
 
+#include "YouTubeBufferedStream.h"
+#include "YouTubeChatFrame.h"
+#include "YouTubeChatText.h"
+#include "YouTubeTime.h"
+
 #ifdef YOUTUBE_PRINT_JSON_PARSE
 #include <StreamUtils.h>
 #endif
@@ -49,7 +54,22 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
 
 #define YOUTUBE_TIMEOUT 2000
 
-#define YOUTUBE_MAX_RESULTS 100
+#define YOUTUBE_MAX_RESULTS 100 // Most messages handed to the callback per call
+
+// Size of the document used to parse chat messages when chatPageSize is 0 (server decides the page size)
+#define YOUTUBE_CHAT_DOC_SIZE 30000
+
+// Used to size the document when chatPageSize is set, roughly what one
+// filtered message takes up plus the fixed part of the response.
+#define YOUTUBE_CHAT_DOC_BASE_SIZE 512
+#define YOUTUBE_CHAT_DOC_BYTES_PER_MESSAGE 400
+
+// Limits for adaptChatPageSize. The API docs list 200 as the smallest maxResults,
+// if the server starts rejecting smaller pages raise YOUTUBE_CHAT_MIN_PAGE_SIZE.
+#define YOUTUBE_CHAT_MIN_PAGE_SIZE 5
+#define YOUTUBE_CHAT_MAX_PAGE_SIZE YOUTUBE_MAX_RESULTS
+#define YOUTUBE_CHAT_PAGE_SIZE_STEP 5
+#define YOUTUBE_HEAP_RESERVE 4096 // Left free after the chat document is allocated (TLS is already connected by then)
 
 #define YOUTUBE_MSG_CHAR_LENGTH 100 //Increase if MSG are being cut off
 #define YOUTUBE_NAME_CHAR_LENGTH 50
@@ -59,12 +79,30 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
 
 #define YOUTUBE_VIDEO_ID_LENGTH 12 // Actually 11, leaving room for null terminator
 
+// Quota cost of each API call, used to pick the cheapest way of finding a live stream
+#define YOUTUBE_SEARCH_QUOTA_COST 100
+#define YOUTUBE_VIDEOS_QUOTA_COST 1
+
+// How much time and download we consider to be worth one unit of quota when comparing
+// scraping (free, but a big page) to the search endpoint (101 with the verify call).
+// A channel page of ~700KB taking ~4s scores about 35 + 40 + 1 = 76, so scraping is
+// picked while it works, but search takes over once roughly 1 in 4 scrapes fail
+// (or the page gets a lot bigger/slower). 0 leaves that part out of the cost.
+#define YOUTUBE_QUOTA_UNIT_COST_MILLIS 100
+#define YOUTUBE_QUOTA_UNIT_COST_BYTES 20000
+
 #define YOUTUBE_VIDEOS_ENDPOINT "/youtube/v3/videos"
 #define YOUTUBE_LIVECHAT_MESSAGES_ENDPOINT "/youtube/v3/liveChat/messages"
 
+// If a Date header puts the server clock this far behind our estimate, start the estimate again
+#define YOUTUBE_CLOCK_RESET_MILLIS 5000
+
 // Required when scraping or it will bring you to a accept cookie landing page
 #define YOUTUBE_ACCEPT_COOKIES_COOKIE "CONSENT=YES+cb.20210530-19-p0.en-GB+FX+999"
 
+// Always on the channel page before the live badge, if it's missing the page has changed
+#define YOUTUBE_SCRAPE_PAGE_MARKER "ytInitialData"
+
 enum YoutubeMessageType
 {
     yt_message_type_unknown,
@@ -73,6 +111,47 @@ enum YoutubeMessageType
     yt_message_type_superSticker
 };
 
+enum YoutubeLiveCheckResult
+{
+    yt_live_check_error,
+    yt_live_check_not_live,
+    yt_live_check_live
+};
+
+enum YoutubeLiveDetectMethod
+{
+    yt_detect_none,
+    yt_detect_scrape,
+    yt_detect_search
+};
+
+// Running totals for one way of finding a live stream, used by getLiveStreamIds
+struct LiveDetectMethodStats
+{
+    unsigned int attempts;
+    unsigned int successes; // Got an answer we trust (live and verified, or not live)
+    unsigned long quotaUsed;
+    unsigned long totalMillis;
+    unsigned long totalBytes;
+};
+
+// Order messages are handed to the callback in when prioritiseChatMessages is set
+enum YoutubeChatPriority
+{
+    yt_priority_super, // Super chats and super stickers
+    yt_priority_owner_or_moderator,
+    yt_priority_regular,
+    yt_priority_count
+};
+
+// A message picked to be handed to the callback, in the order it'll be dispatched
+struct ChatDispatchEntry
+{
+    JsonObject item;
+    uint16_t index; // Position in the items array, the API caps it at 2000
+    uint8_t priority;
+};
+
 struct LiveStreamDetails
 {
     char *concurrentViewers;
@@ -86,6 +165,7 @@ struct ChatMessage
 {
     YoutubeMessageType type;
     const char *displayMessage;
+    const char *normalizedMessage; // Only set if normalizeChatMessages is enabled
     const char *displayName;
     int tier;
     long amountMicros;
@@ -94,6 +174,18 @@ struct ChatMessage
     bool isChatOwner;
     bool isChatSponsor;
     bool isVerified;
+    int64_t publishedAtMillis; // When it was sent, ms since 1970 (UTC), -1 if not known
+    long latencyMillis; // Time from it being sent to the callback, -1 if not known yet
+};
+
+// How stale chat messages are by the time they reach the callback, all in milliseconds.
+// See YouTubeTime.h for reading the histograms.
+struct ChatFreshnessStats
+{
+    ChatLatencyHistogram pollWait; // Published until we made the request
+    ChatLatencyHistogram publishToResponse; // Published until the response arrived
+    ChatLatencyHistogram responseToCallback; // Response arriving until the callback (parsing etc.)
+    ChatLatencyHistogram publishToCallback; // The whole thing
 };
 
 struct ChatResponses
@@ -102,6 +194,8 @@ struct ChatResponses
     int resultsPerPage;
     long pollingIntervalMillis;
     int numMessages;
+    int backlog; // Messages still waiting on the server after a full page, if > 0 call getChatMessages again soon
+    int pageSize; // maxResults that was requested (0 if not set)
     bool isStillLive;
     bool error;
 };
@@ -116,15 +210,61 @@ class YouTubeLiveStream
     int makeGetRequest(const char *command, const char *host = YOUTUBE_API_HOST, const char *accept = "application/json", const char *cookie = NULL);
     bool getLiveVideoId(const char *channelId, char *videoIdOut, int videoIdOutSize);
     bool scrapeIsChannelLive(const char *channelId, char *videoIdOut = NULL, int videoIdOutSize = 0);
+    bool getLiveStreamIds(const char *channelId, char *videoIdOut, int videoIdOutSize, char *liveChatIdOut, int liveChatIdOutSize);
+    YoutubeLiveDetectMethod chooseLiveDetectMethod();
     LiveStreamDetails getLiveStreamDetails(const char *videoId);
     ChatResponses getChatMessages(processChatMessage chatMessageCallback, const char *liveChatId, bool reverse = false, const char *part = "id,snippet,authorDetails");
     int portNumber = 443;
+
+    // Deliver super chats/stickers first, then owner/moderator messages, then the rest.
+    // Each group keeps the forward/reverse order unless sortPriorityByAmount is set,
+    // which puts the super chats/stickers with the highest tier/amount first.
+    bool prioritiseChatMessages = false;
+    bool sortPriorityByAmount = false;
+
+    // Also give each message a lower case copy with emoji and extra whitespace removed
+    // as chatMessage.normalizedMessage, handy for matching commands (see YouTubeChatText.h)
+    bool normalizeChatMessages = false;
+
+    // Ask the server for at most this many messages per call (0 lets the server decide, up to a few hundred).
+    // The document used to parse the messages is sized to match, so this is what makes chat
+    // work on boards like the ESP8266. With adaptChatPageSize the page size is shrunk to fit
+    // the free heap, halved if parsing runs out of memory and grown while there is a backlog.
+    int chatPageSize = 0;
+    bool adaptChatPageSize = false;
+    int chatPageSizeLimit = 0; // Set when a page runs out of memory, raised again once there's heap to spare (0 for no limit)
+
+    // Freshness of chat messages, the publish based ones need the server clock offset,
+    // which is worked out from the HTTP Date header of the API responses.
+    ChatFreshnessStats chatFreshness;
+    int64_t serverClockOffsetMillis = 0; // Server time (ms since 1970) minus millis()
+    bool haveServerClockOffset = false;
+    int64_t serverTimeMillis(); // Current server time estimate, -1 if not known yet
+    void resetChatFreshness();
+
     bool _debug = true;
     Client *client;
+
+    // All responses are read through this, see YouTubeBufferedStream.h.
+    // readCalls/bytesRead show how much work the client is doing.
+    YouTubeBufferedStream stream;
     char nextPageToken[50];
     void initStructs();
     void destroyStructs();
 
+    // Encode a chat message as a compact binary frame (see YouTubeChatFrame.h)
+    // Strings are written straight from the message, returns bytes written or 0 on failure
+    static size_t chatMessageFrameSize(const ChatMessage &chatMessage);
+    static size_t writeChatMessageFrame(Print &out, const ChatMessage &chatMessage);
+    static size_t writeChatMessageFrame(uint8_t *buffer, size_t bufferSize, const ChatMessage &chatMessage);
+
+    // Stats used by getLiveStreamIds to pick between scraping and the search endpoint
+    LiveDetectMethodStats scrapeStats;
+    LiveDetectMethodStats searchStats;
+    YoutubeLiveDetectMethod lastDetectMethod = yt_detect_none;
+    unsigned long quotaUnitCostMillis = YOUTUBE_QUOTA_UNIT_COST_MILLIS;
+    unsigned long quotaUnitCostBytes = YOUTUBE_QUOTA_UNIT_COST_BYTES;
+
   private:
     const char *_apiToken;
     const char **_apiTokenArray;
@@ -134,10 +274,29 @@ class YouTubeLiveStream
     void rotateApiKey();
     void skipHeaders(bool tossUnexpectedForJSON = true);
     void closeClient();
+    static size_t encodeChatMessageFrame(Print *out, const ChatMessage &chatMessage);
+    void parseChatMessage(JsonObject item);
+    int chatMessagePriority(JsonObject item);
+    int orderChatMessages(JsonArray items, bool reverse, ChatDispatchEntry *dispatchOrder);
+    bool dispatchesBefore(const ChatDispatchEntry &a, const ChatDispatchEntry &b, bool reverse);
+    int compareSuperDetails(JsonObject a, JsonObject b);
+    size_t chatDocumentSize();
+    size_t fitChatDocumentToHeap(size_t documentSize);
+    int largestParsedChatPageSize = 0;
+    long largestFreeHeapBlock();
+    void updateServerClock(const char *dateValue);
+    void recordChatFreshness();
+    unsigned long requestStartMillis = 0;
+    unsigned long responseMillis = 0;
+    YoutubeLiveCheckResult searchForLiveVideo(const char *channelId, char *videoIdOut, int videoIdOutSize);
+    YoutubeLiveCheckResult scrapeForLiveVideo(const char *channelId, char *videoIdOut, int videoIdOutSize);
+    YoutubeLiveCheckResult detectLiveStream(YoutubeLiveDetectMethod method, const char *channelId, char *videoIdOut, int videoIdOutSize, char *liveChatIdOut, int liveChatIdOutSize);
+    float liveDetectScore(const LiveDetectMethodStats &stats, unsigned long expectedQuota);
 
     LiveStreamDetails liveStreamDetails;
     ChatResponses chatResponses;
     ChatMessage chatMessage;
+    char normalizedMessageBuffer[YOUTUBE_MSG_CHAR_LENGTH];
     const char *searchEndpointAndParams = 
         R"(/youtube/v3/search?eventType=live&part=id&channelId=%s&type=video&key=%s&maxResults=1&isMine=true)"
     ;
@@ -0,0 +1,236 @@
+/*
+Copyright (c) 2020 Brian Lough. All right reserved.
+
+YouTubeTime - Timestamp parsing and latency histograms for chat freshness
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "YouTubeTime.h"
+
+#include <string.h>
+
+// Reads count digits at text, returns -1 if any of them aren't digits
+static int readDigits(const char *text, int count)
+{
+    int value = 0;
+    for (int i = 0; i < count; i++)
+    {
+        unsigned int digit = (unsigned char)text[i] - '0';
+        if (digit > 9)
+        {
+            return -1;
+        }
+        value = value * 10 + digit;
+    }
+    return value;
+}
+
+// Days since 1970-01-01 for a date in the (proleptic) Gregorian calendar
+static int64_t daysFromCivil(int year, int month, int day)
+{
+    year -= month <= 2;
+    int64_t era = (year >= 0 ? year : year - 399) / 400;
+    int64_t yearOfEra = year - era * 400;
+    int64_t dayOfYear = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    int64_t dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+    return era * 146097 + dayOfEra - 719468;
+}
+
+static int64_t toEpochMillis(int year, int month, int day, int hour, int minute, int second, int millis)
+{
+    if (month < 1 || month > 12 || day < 1 || day > 31 || hour > 23 || minute > 59 || second > 60)
+    {
+        return -1;
+    }
+    int64_t days = daysFromCivil(year, month, day);
+    return ((days * 24 + hour) * 60 + minute) * 60000LL + second * 1000LL + millis;
+}
+
+int64_t parseRfc3339Millis(const char *text)
+{
+    if (text == NULL || strlen(text) < 20)
+    {
+        return -1;
+    }
+
+    // Fixed part: YYYY-MM-DDTHH:MM:SS
+    if (text[4] != '-' || text[7] != '-' || (text[10] != 'T' && text[10] != 't') || text[13] != ':' || text[16] != ':')
+    {
+        return -1;
+    }
+
+    int year = readDigits(text, 4);
+    int month = readDigits(text + 5, 2);
+    int day = readDigits(text + 8, 2);
+    int hour = readDigits(text + 11, 2);
+    int minute = readDigits(text + 14, 2);
+    int second = readDigits(text + 17, 2);
+    if (year < 0 || month < 0 || day < 0 || hour < 0 || minute < 0 || second < 0)
+    {
+        return -1;
+    }
+
+    // Optional fraction, any number of digits but only milliseconds are kept
+    const char *pos = text + 19;
+    int millis = 0;
+    if (*pos == '.')
+    {
+        pos++;
+        int digits = 0;
+        while ((unsigned int)((unsigned char)*pos - '0') <= 9)
+        {
+            if (digits < 3)
+            {
+                millis = millis * 10 + (*pos - '0');
+            }
+            digits++;
+            pos++;
+        }
+        if (digits == 0)
+        {
+            return -1;
+        }
+        for (; digits < 3; digits++)
+        {
+            millis *= 10;
+        }
+    }
+
+    int64_t result = toEpochMillis(year, month, day, hour, minute, second, millis);
+    if (result < 0)
+    {
+        return -1;
+    }
+
+    if (*pos == 'Z' || *pos == 'z')
+    {
+        return result;
+    }
+
+    if (*pos == '+' || *pos == '-')
+    {
+        // Hours first, so a truncated string stops at its NUL before we look past it
+        int offsetHours = readDigits(pos + 1, 2);
+        if (offsetHours < 0 || pos[3] != ':')
+        {
+            return -1;
+        }
+        int offsetMinutes = readDigits(pos + 4, 2);
+        if (offsetMinutes < 0)
+        {
+            return -1;
+        }
+        int64_t offset = (offsetHours * 60 + offsetMinutes) * 60000LL;
+        return (*pos == '+') ? result - offset : result + offset;
+    }
+
+    return -1;
+}
+
+int64_t parseHttpDateMillis(const char *text)
+{
+    if (text == NULL)
+    {
+        return -1;
+    }
+
+    while (*text == ' ')
+    {
+        text++;
+    }
+
+    // Fixed format: "Sun, 06 Nov 1994 08:49:37 GMT"
+    if (strlen(text) < 29 || text[3] != ',' || text[4] != ' ' || text[7] != ' ' || text[11] != ' ' ||
+        text[16] != ' ' || text[19] != ':' || text[22] != ':' || strncmp(text + 25, " GMT", 4) != 0)
+    {
+        return -1;
+    }
+
+    static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+    int month = 0;
+    for (int i = 0; i < 12; i++)
+    {
+        if (strncmp(text + 8, months + i * 3, 3) == 0)
+        {
+            month = i + 1;
+            break;
+        }
+    }
+
+    int day = readDigits(text + 5, 2);
+    int year = readDigits(text + 12, 4);
+    int hour = readDigits(text + 17, 2);
+    int minute = readDigits(text + 20, 2);
+    int second = readDigits(text + 23, 2);
+    if (month == 0 || day < 0 || year < 0 || hour < 0 || minute < 0 || second < 0)
+    {
+        return -1;
+    }
+
+    return toEpochMillis(year, month, day, hour, minute, second, 0);
+}
+
+void addLatencySample(ChatLatencyHistogram &histogram, int64_t millis)
+{
+    if (millis < 0)
+    {
+        millis = 0;
+    }
+    if (millis > UINT32_MAX)
+    {
+        millis = UINT32_MAX;
+    }
+
+    uint32_t value = (uint32_t)millis;
+    int bucket = 0;
+    while (value > 0 && bucket < YOUTUBE_LATENCY_BUCKETS - 1)
+    {
+        value >>= 1;
+        bucket++;
+    }
+
+    histogram.buckets[bucket]++;
+    histogram.count++;
+    histogram.totalMillis += millis;
+    if (millis > histogram.maxMillis)
+    {
+        histogram.maxMillis = millis;
+    }
+}
+
+uint32_t latencyPercentile(const ChatLatencyHistogram &histogram, uint8_t percent)
+{
+    if (histogram.count == 0)
+    {
+        return 0;
+    }
+
+    uint64_t target = ((uint64_t)histogram.count * percent + 99) / 100;
+    if (target == 0)
+    {
+        target = 1;
+    }
+
+    uint64_t seen = 0;
+    for (int i = 0; i < YOUTUBE_LATENCY_BUCKETS - 1; i++)
+    {
+        seen += histogram.buckets[i];
+        if (seen >= target)
+        {
+            uint32_t upper = 1UL << i;
+            return upper < histogram.maxMillis ? upper : histogram.maxMillis;
+        }
+    }
+    return histogram.maxMillis;
+}
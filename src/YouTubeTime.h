@@ -0,0 +1,50 @@
+/*
+Copyright (c) 2020 Brian Lough. All right reserved.
+
+YouTubeTime - Timestamp parsing and latency histograms for chat freshness
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef YouTubeTime_h
+#define YouTubeTime_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Bucket 0 is under 1ms, bucket i is [2^(i-1), 2^i) ms, the last one takes everything bigger (~65s+)
+#define YOUTUBE_LATENCY_BUCKETS 18
+
+struct ChatLatencyHistogram
+{
+    uint32_t buckets[YOUTUBE_LATENCY_BUCKETS];
+    uint32_t count;
+    uint32_t maxMillis;
+    uint64_t totalMillis;
+};
+
+// Parses timestamps like "2021-06-12T19:29:49.374Z" or "2021-06-12T19:29:49.374321+01:00"
+// as used by the API. Returns milliseconds since 1970 (UTC), or -1 if it's not in that format.
+int64_t parseRfc3339Millis(const char *text);
+
+// Parses an HTTP Date header value like "Sat, 12 Jun 2021 19:29:50 GMT".
+// Returns milliseconds since 1970 (UTC), or -1 if it's not in that format.
+int64_t parseHttpDateMillis(const char *text);
+
+// Negative samples (clock error) are counted as 0
+void addLatencySample(ChatLatencyHistogram &histogram, int64_t millis);
+
+// Upper bound of the bucket the given percentile (0-100) falls in, 0 if there are no samples
+uint32_t latencyPercentile(const ChatLatencyHistogram &histogram, uint8_t percent);
+
+#endif